@@ -0,0 +1,290 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <core/error.h>
+#include <gc.h>
+#include <interpreter.h>
+#include <module.h>
+#include <stdint.h>
+#include <string.h>
+#include <value.h>
+
+// Runtime of programs compiled ahead of time by plume-aot (see tools/aot.c).
+// Each bytecode function becomes a C function running its frame on the
+// module's stack, with the frames, values and natives of the interpreter.
+// Function values hold the index of their first instruction in the decoded
+// bytecode.
+
+// Runs the frame entered by the caller. Returns -1 once it has returned, or
+// the entry of the function it tail-called, whose frame replaced it.
+typedef int32_t (*AotFunction)(Deserialized *module);
+
+// Runs the frame of the function at `ipc`, and the ones replacing it.
+void aot_run(Deserialized *module, int32_t ipc);
+
+// Calls a function or native with the arguments on the stack, and pushes its
+// result.
+void aot_call(Deserialized *module, Value callee, int32_t argc);
+
+Value aot_call_function(Deserialized *module, Value callee, int32_t argc, Value* argv);
+
+// Entry point of compiled programs: loads the embedded bytecode for its
+// constants and libraries, and runs the top level.
+int aot_main(int argc, char **argv, const uint8_t *bytecode, size_t size, AotFunction *functions);
+
+static inline Value aot_compare(int32_t kind, Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) {
+    switch (kind) {
+      case KindGreaterThan: return MAKE_INTEGER((int32_t) GET_INT(a) > (int32_t) GET_INT(b));
+      case KindEqualTo: return MAKE_INTEGER(a == b);
+    }
+  }
+
+  return comparison_table[kind](a, b);
+}
+
+// Instructions, as in run_interpreter. Compiled functions keep the stack
+// and base pointers in locals, and write them back around calls.
+
+#define AOT_ENTER()                                       \
+  Value* values = module->stack->values;                  \
+  Value* sp = values + module->stack->stack_pointer;      \
+  Value* bp = values + module->base_pointer
+
+#define AOT_SAVE_STATE()                                  \
+  do {                                                    \
+    module->stack->stack_pointer = sp - values;           \
+    module->base_pointer = bp - values;                   \
+  } while (0)
+
+#define AOT_LOAD_STATE()                                  \
+  do {                                                    \
+    values = module->stack->values;                       \
+    sp = values + module->stack->stack_pointer;           \
+    bp = values + module->base_pointer;                   \
+  } while (0)
+
+#define AOT_CONSTANT(idx) (module->constants.constants[idx])
+
+#define AOT_LOAD_LOCAL(slot) (*sp++ = bp[slot])
+#define AOT_STORE_LOCAL(slot) (bp[slot] = *--sp)
+#define AOT_LOAD_CONSTANT(value) (*sp++ = (value))
+#define AOT_LOAD_GLOBAL(idx) (*sp++ = values[idx])
+#define AOT_STORE_GLOBAL(idx) (values[idx] = *--sp)
+
+#define AOT_RETURN(value)                                 \
+  do {                                                    \
+    Value ret_ = (value);                                 \
+    Frame fr_ = pop_frame(module);                        \
+    values[fr_.stack_pointer] = ret_;                     \
+    module->stack->stack_pointer = fr_.stack_pointer + 1; \
+    module->base_pointer = fr_.base_ptr;                  \
+    module->pc = fr_.instruction_pointer;                 \
+    return -1;                                            \
+  } while (0)
+
+#define AOT_RETURN_UNIT() AOT_RETURN(unit_value)
+
+#define AOT_COMPARE(kind)                                 \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    sp[-1] = aot_compare(kind, sp[-1], a_);               \
+  } while (0)
+
+#define AOT_LOGICAL(op)                                   \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    Value b_ = sp[-1];                                    \
+    ASSERT_FMT(IS_INT(a_) && IS_INT(b_), "Expected integers, got %s and %s", type_of(a_), type_of(b_)); \
+    sp[-1] = MAKE_INTEGER(a_ op b_);                      \
+  } while (0)
+
+#define AOT_LOAD_NATIVE(name, lib, idx)                   \
+  do {                                                    \
+    *sp++ = MAKE_INTEGER(lib);                            \
+    *sp++ = MAKE_INTEGER(idx);                            \
+    *sp++ = AOT_CONSTANT(name);                           \
+  } while (0)
+
+#define AOT_MAKE_LIST(n)                                  \
+  do {                                                    \
+    sp -= (n);                                            \
+    if ((n) == 0) {                                       \
+      *sp = empty_list;                                   \
+    } else if (IS_CONSTRUCTOR(sp, (n))) {                 \
+      *sp = MAKE_CONSTRUCTOR(module->stack, sp, (n));     \
+    } else if (IS_CLOSURE(sp, (n))) {                     \
+      FunctionDescriptor* function_ = get_function(module, sp[1]); \
+      *sp = MAKE_CLOSURE(module->stack, sp, function_->entry, function_->local_space); \
+    } else {                                              \
+      Value* items_ = GC_malloc(sizeof(Value) * (n));     \
+      memcpy(items_, sp, (n) * sizeof(Value));            \
+      *sp = MAKE_LIST(module->stack, items_, (n));        \
+    }                                                     \
+    sp++;                                                 \
+  } while (0)
+
+#define AOT_LIST_GET(idx)                                 \
+  do {                                                    \
+    Value list_ = sp[-1];                                 \
+    ASSERT(get_type(list_) == TYPE_LIST, "Invalid list type"); \
+    HeapValue* l_ = GET_PTR(list_);                       \
+    ASSERT((uint32_t) (idx) < l_->length, "Index out of bounds"); \
+    sp[-1] = l_->as_ptr[idx];                             \
+  } while (0)
+
+#define AOT_CONSTRUCTOR_TAG(idx)                          \
+  do {                                                    \
+    AOT_LIST_GET(idx);                                    \
+    sp[-1] = MAKE_INTEGER(constructor_tag(module, sp[-1])); \
+  } while (0)
+
+#define AOT_GET_INDEX()                                   \
+  do {                                                    \
+    Value index_ = *--sp;                                 \
+    Value list_ = sp[-1];                                 \
+    ASSERT(get_type(list_) == TYPE_LIST, "Invalid list type"); \
+    ASSERT(get_type(index_) == TYPE_INTEGER, "Invalid index type"); \
+    HeapValue* l_ = GET_PTR(list_);                       \
+    ASSERT(GET_INT(index_) < l_->length, "Index out of bounds"); \
+    sp[-1] = l_->as_ptr[GET_INT(index_)];                 \
+  } while (0)
+
+#define AOT_SLICE(start)                                  \
+  do {                                                    \
+    Value list_ = sp[-1];                                 \
+    ASSERT(get_type(list_) == TYPE_LIST, "Invalid list type"); \
+    HeapValue* l_ = GET_PTR(list_);                       \
+    HeapValue* new_list_ = allocate(module->stack, TYPE_LIST, l_->length - (start)); \
+    new_list_->as_ptr = GC_malloc(sizeof(Value) * new_list_->length); \
+    memcpy(new_list_->as_ptr, &l_->as_ptr[start], (l_->length - (start)) * sizeof(Value)); \
+    sp[-1] = MAKE_PTR(new_list_);                         \
+  } while (0)
+
+#define AOT_LIST_LENGTH()                                 \
+  do {                                                    \
+    ASSERT(get_type(sp[-1]) == TYPE_LIST, "Invalid list type"); \
+    sp[-1] = MAKE_INTEGER(GET_PTR(sp[-1])->length);       \
+  } while (0)
+
+#define AOT_TYPE_OF() (sp[-1] = type_names[get_type(sp[-1])])
+#define AOT_SPECIAL() (*sp++ = MAKE_SPECIAL())
+
+#define AOT_UPDATE()                                      \
+  do {                                                    \
+    Value var_ = *--sp;                                   \
+    ASSERT(get_type(var_) == TYPE_MUTABLE, "Invalid mutable type"); \
+    *GET_PTR(var_)->as_ptr = *--sp;                       \
+  } while (0)
+
+#define AOT_MAKE_MUTABLE()                                \
+  do {                                                    \
+    Value* v_ = GC_malloc(sizeof(Value));                 \
+    *v_ = sp[-1];                                         \
+    HeapValue* l_ = allocate(module->stack, TYPE_MUTABLE, 1); \
+    l_->as_ptr = v_;                                      \
+    sp[-1] = MAKE_PTR(l_);                                \
+  } while (0)
+
+#define AOT_UNMUT()                                       \
+  do {                                                    \
+    ASSERT(get_type(sp[-1]) == TYPE_MUTABLE, "Invalid mutable type"); \
+    sp[-1] = GET_MUTABLE(sp[-1]);                         \
+  } while (0)
+
+// Arithmetic, where the deeper operand comes first (see arithmetic).
+#define AOT_ARITH(opcode)                                 \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    Value b_ = sp[-1];                                    \
+    sp[-1] = arithmetic(module, (opcode), b_, a_);        \
+  } while (0)
+
+#define AOT_ARITH_CONST(opcode, value)                    \
+  do {                                                    \
+    Value a_ = sp[-1];                                    \
+    sp[-1] = arithmetic(module, (opcode), a_, (value));   \
+  } while (0)
+
+// Conditional jumps go to `label` when the condition is false.
+#define AOT_JUMP_ELSE(label)                              \
+  do {                                                    \
+    Value v_ = *--sp;                                     \
+    ASSERT(get_type(v_) == TYPE_INTEGER, "Invalid value type"); \
+    if (GET_INT(v_) == 0) goto label;                     \
+  } while (0)
+
+#define AOT_JUMP_ELSE_CMP(kind, label)                    \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    Value b_ = *--sp;                                     \
+    if (GET_INT(aot_compare(kind, a_, b_)) == 0) goto label; \
+  } while (0)
+
+#define AOT_IJUMP_ELSE_CMP(op, label)                     \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    Value b_ = *--sp;                                     \
+    if (IS_INT(a_) && IS_INT(b_)) {                       \
+      if ((GET_INT(a_) op GET_INT(b_)) == 0) goto label;  \
+    } else {                                              \
+      ASSERT(IS_INTEGER(a_) && IS_INTEGER(b_), "Expected integers"); \
+      if ((GET_INT64(a_) op GET_INT64(b_)) == 0) goto label; \
+    }                                                     \
+  } while (0)
+
+#define AOT_JUMP_ELSE_CMP_CONST(value, label)             \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    if (GET_INT(compare_eq(a_, (value))) == 0) goto label; \
+  } while (0)
+
+#define AOT_IJUMP_ELSE_CMP_CONST(op, value, label)        \
+  do {                                                    \
+    Value a_ = *--sp;                                     \
+    ASSERT(IS_INTEGER(a_), "Expected integers");          \
+    if (IS_INT(a_) ? ((int32_t) GET_INT(a_) op (int32_t) GET_INT(value)) == 0 \
+                   : (GET_INT64(a_) op GET_INT64(value)) == 0) goto label; \
+  } while (0)
+
+// Boxed integers are outside the range of the keys of a switch, and go to
+// its default case.
+#define AOT_SWITCH_BOXED(label)                           \
+  do {                                                    \
+    if (!IS_INT(sp[-1])) {                                \
+      ASSERT(IS_INT64(sp[-1]), "Expected integer");       \
+      sp--;                                               \
+      goto label;                                         \
+    }                                                     \
+  } while (0)
+
+// Key of a switch, compared with the keys of its cases as unsigned values.
+static inline uint32_t aot_switch_key(Value key) {
+  ASSERT(IS_INT(key), "Expected integer");
+  return GET_INT(key);
+}
+
+#define AOT_CALL(callee, argc)                            \
+  do {                                                    \
+    Value callee_ = (callee);                             \
+    AOT_SAVE_STATE();                                     \
+    aot_call(module, callee_, argc);                      \
+    AOT_LOAD_STATE();                                     \
+  } while (0)
+
+// Natives and closures do not replace the frame: their result is returned by
+// the next instruction.
+#define AOT_TAIL_CALL(callee, argc)                       \
+  do {                                                    \
+    Value callee_ = (callee);                             \
+    ASSERT(IS_FUN(callee_) || IS_PTR(callee_), "Invalid callee type"); \
+    AOT_SAVE_STATE();                                     \
+    if (IS_FUN(callee_)) {                                \
+      op_tail_call(module, callee_, argc);                \
+      return module->pc;                                  \
+    }                                                     \
+    aot_call(module, callee_, argc);                      \
+    AOT_LOAD_STATE();                                     \
+  } while (0)
+
+#endif  // AOT_H
@@ -43,15 +43,87 @@ typedef enum {
   OP_JumpElseRelCmpConst,
   OP_IJumpElseRelCmpConst,
   OP_CallGlobal,
-  OP_CallNative,
+  OP_CallLocal,
   OP_MakeAndStoreLambda,
+  OP_Mul,
+  OP_MulConst,
+  OP_ReturnUnit,
+
+  // Superinstructions produced by the load-time fusion pass. They never
+  // appear in serialized bytecode.
+  OP_LoadLocal2,
+  OP_AddLocals,
+  OP_SubLocals,
+  OP_MulLocals,
+  OP_LoadLocalAddConst,
+  OP_LoadLocalSubConst,
+  OP_AddConstLocal,
+  OP_SubConstLocal,
+  OP_LoadLocalListGet,
+
+  // Native call bound at load time (see link_natives).
+  OP_CallNative,
+
+  // Calls directly followed by a return, which reuse the caller's frame
+  // (see detect_tail_calls).
+  OP_TailCall,
+  OP_TailCallGlobal,
+  OP_TailCallLocal,
+
+  // Multiway branches on an integer, built from chains of comparisons (see
+  // build_switches). The instruction is followed by its table of
+  // SwitchCase entries, each jumping to the case of its key. Dense
+  // switches have an entry for every key from the smallest one, and sparse
+  // ones have entries sorted by key.
+  OP_Switch,
+  OP_SwitchSparse,
+  OP_SwitchCase,
+
+  // Replaces the string at index operand1 of a list with its tag (see
+  // constructor_tag), so that matches on constructor names compare integers.
+  OP_ConstructorTag,
+
+  // Counts the executions of the block it starts, indexed by operand1, when
+  // recording a profile (see profile.h).
+  OP_Count,
+
+  // Leaves the interpreter loop with the value on top of the stack. Frames
+  // entered from C return to the only one, placed after the code (see
+  // run_call).
+  OP_Exit,
+
+  // Register form produced by translate_registers. Operands name frame slots
+  // relative to the base pointer: locals are negative, and the operand stack
+  // entry at depth d lives in slot d.
+  OP_RMove,
+  OP_RLoadConstant,
+  OP_RAdd,
+  OP_RSub,
+  OP_RMul,
+  OP_RAddConst,
+  OP_RSubConst,
+  OP_RMulConst,
+  OP_RCompare,
+  OP_RJumpElseRel,
+  OP_RJumpElseRelCmp,
+  OP_RIJumpElseRelCmp,
+  OP_RJumpElseRelCmpConst,
+  OP_RIJumpElseRelCmpConst,
+  OP_RReturn,
+
+  OPCODE_COUNT,
 } Opcode;
 
+#define SERIALIZED_OPCODE_COUNT (OP_ReturnUnit + 1)
+
 typedef struct {
   Opcode opcode;
   int32_t operand1;
   int32_t operand2;
   int32_t operand3;
+
+  // Only used by register instructions.
+  int32_t operand4;
 } Instruction;
 
 typedef struct {
@@ -81,4 +153,119 @@ typedef enum {
   Or = 7,
 } Comparison;
 
+// Kinds of Compare, JumpElseRelCmp and IJumpElseRelCmp, which index the
+// interpreter's comparison_table. Instructions comparing with a constant
+// take a Comparison instead.
+typedef enum {
+  KindGreaterThan = 1,
+  KindEqualTo = 2,
+  KindAnd = 5,
+  KindOr = 6,
+} ComparisonKind;
+
+Bytecode decode_bytecode(int32_t* raw, int32_t instr_count);
+
+// Returns the absolute target of a relative jump (including the jump over a
+// lambda body), or -1 if the instruction does not jump.
+int32_t jump_target(Instruction* instrs, int32_t idx);
+
+// Rewrites the offset of a jump so that it lands on the absolute `target`.
+void set_jump_target(Instruction* instrs, int32_t idx, int32_t target);
+
+// Net number of values pushed on the operand stack by the instruction at
+// `idx` (negative when it pops more than it pushes). Register instructions
+// have no fixed effect, so stack depths are computed before translating to
+// register form.
+int32_t stack_effect(Instruction* instrs, int32_t idx);
+
+// Whether execution may continue with the next instruction.
+bool falls_through(Instruction* instr);
+
+// Number of slots the instruction spans. Instructions rewritten by
+// load-time passes keep the slots of the sequence they replace.
+int32_t instruction_size(Instruction* instr);
+
+bool* find_jump_targets(Bytecode* bytecode);
+
+// Drops the instructions marked in `removed`. Jumps to a removed instruction
+// land on the next one that remains.
+void remove_instructions(Bytecode* bytecode, bool* removed);
+
+// Marks each instruction with the entry of the innermost function owning it:
+// 0 for the top level, and the instruction following the header for lambda
+// bodies. Nesting must have been verified.
+void find_owners(Bytecode* bytecode, int32_t* owners);
+
+// Finds the header of the MakeAndStoreLambda defining each global, or -1
+// when the global is not a known function. Globals holding a function are
+// those stored once, by a single MakeAndStoreLambda. `definitions` has an
+// entry per global.
+void find_definitions(Bytecode* bytecode, int32_t* owners, int32_t* definitions);
+
+// Returns the constant pool index used by the instruction, or -1.
+static inline int32_t constant_operand(Instruction* instr) {
+  switch (instr->opcode) {
+    case OP_LoadConstant: case OP_ReturnConst: case OP_AddConst:
+    case OP_SubConst: case OP_MulConst:
+      return instr->operand1;
+    case OP_RLoadConstant:
+      return instr->operand2;
+    case OP_JumpElseRelCmpConst: case OP_IJumpElseRelCmpConst:
+    case OP_LoadLocalAddConst: case OP_LoadLocalSubConst:
+    case OP_AddConstLocal: case OP_SubConstLocal:
+    case OP_RJumpElseRelCmpConst:
+      return instr->operand3;
+    case OP_RAddConst: case OP_RSubConst: case OP_RMulConst:
+    case OP_RIJumpElseRelCmpConst:
+      return instr->operand4;
+    default:
+      return -1;
+  }
+}
+
+// Threaded code executed by the interpreter is a stream of 32-bit words. An
+// instruction starts with the offset of its handler, followed by the operands
+// it uses, and then by the constant it loads, if any, resolved from the
+// constant pool at load time. Jump offsets count words. Function headers
+// have an extra operand holding the index of the function they create in the
+// module's descriptor table, which has its entry.
+
+// Number of operands kept in threaded code, not counting the constant. They
+// are always the first operands of the instruction.
+static inline int32_t operand_count(Opcode opcode) {
+  switch (opcode) {
+    case OP_LoadLocal: case OP_StoreLocal: case OP_LoadGlobal:
+    case OP_StoreGlobal: case OP_Compare: case OP_MakeList: case OP_ListGet:
+    case OP_Call: case OP_JumpElseRel: case OP_JumpRel: case OP_Slice:
+    case OP_JumpElseRelCmpConst: case OP_LoadLocalAddConst:
+    case OP_LoadLocalSubConst: case OP_TailCall: case OP_RLoadConstant:
+    case OP_RReturn: case OP_ConstructorTag: case OP_Count:
+      return 1;
+    case OP_JumpElseRelCmp: case OP_IJumpElseRelCmp:
+    case OP_IJumpElseRelCmpConst: case OP_LoadLocal2: case OP_AddLocals: case OP_SubLocals:
+    case OP_MulLocals: case OP_AddConstLocal: case OP_SubConstLocal:
+    case OP_LoadLocalListGet: case OP_CallNative: case OP_TailCallGlobal:
+    case OP_TailCallLocal: case OP_RMove: case OP_RJumpElseRel:
+    case OP_RJumpElseRelCmpConst: case OP_SwitchSparse: case OP_SwitchCase:
+      return 2;
+    case OP_CallGlobal: case OP_CallLocal: case OP_LoadNative:
+    case OP_MakeLambda: case OP_Switch: case OP_RAddConst:
+    case OP_RSubConst: case OP_RMulConst: case OP_RIJumpElseRelCmpConst:
+      return 3;
+    case OP_RAdd: case OP_RSub: case OP_RMul: case OP_RCompare:
+    case OP_MakeAndStoreLambda: case OP_RJumpElseRelCmp: case OP_RIJumpElseRelCmp:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+// Number of words of the threaded form of an instruction. It only depends on
+// the opcode, so that handlers know their length statically.
+static inline int32_t code_words(Opcode opcode) {
+  Instruction instr = { opcode, 0, 0, 0, 0 };
+  int32_t constant_words = constant_operand(&instr) >= 0 ? (int32_t) (sizeof(uint64_t) / sizeof(int32_t)) : 0;
+  return 1 + operand_count(opcode) + constant_words;
+}
+
 #endif  // BYTECODE_H
@@ -7,21 +7,33 @@
 #include <core/debug.h>
 #include <stdio.h>
 
-#define MAX_FRAMES 1024
+// Number of frames the call stack starts with. It doubles when full.
+#define FRAME_CHUNK 1024
 
+// Where a call returns: the caller's pc past the call instruction, the stack
+// pointer its result is pushed at, and its base pointer.
 typedef struct {
   reg instruction_pointer;
   int32_t stack_pointer;
   int32_t base_ptr;
 } Frame;
 
+// Frames of the active calls, which are kept apart from the values so that
+// returns only load them. `frame_pointer` is the number of active frames.
 typedef struct {
   int32_t frame_pointer;
+  int32_t capacity;
 
-  Frame frames[MAX_FRAMES];
+  Frame *frames;
 } CallStack;
 
-CallStack *callstack_new();
+void callstack_init(CallStack *callstack);
+void callstack_grow(CallStack *callstack);
 void callstack_free(CallStack *callstack);
 
-#endif  // CALLSTACK_H
\ No newline at end of file
+static inline void push_call_frame(CallStack *callstack, Frame frame) {
+  if (callstack->frame_pointer == callstack->capacity) callstack_grow(callstack);
+  callstack->frames[callstack->frame_pointer++] = frame;
+}
+
+#endif  // CALLSTACK_H
@@ -48,4 +48,14 @@ void print_callstack();
 #define ASSERT_ARGC(func, argc, n)
 #endif
 
+// Conditions established by the load-time bytecode verifier. They are only
+// checked again at runtime when debugging the verifier itself.
+#define ENABLE_VERIFIED_ASSERTIONS 0
+
+#if ENABLE_VERIFIED_ASSERTIONS
+#define ASSERT_VERIFIED(condition, message) ASSERT(condition, message)
+#else
+#define ASSERT_VERIFIED(condition, message)
+#endif
+
 #endif  // ERROR_H
\ No newline at end of file
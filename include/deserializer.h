@@ -6,4 +6,7 @@
 
 Deserialized deserialize(FILE *file, Stack *st);
 
+// The interned string of the constant pool equal to `string`, or NULL.
+HeapValue* find_string_constant(Constants* constants, char* string);
+
 #endif  // DESERIALIZER_H
\ No newline at end of file
@@ -3,8 +3,70 @@
 
 #include <module.h>
 
+extern uint64_t executed_instructions;
+
+typedef void (*InterpreterFunc)(struct Deserialized*, Value, int32_t);
+
+// Call handlers, indexed by whether the callee is a bytecode function.
+extern InterpreterFunc interpreter_table[];
+extern InterpreterFunc tail_interpreter_table[];
+
+void push_frame(struct Deserialized *module, Value callee, int32_t argc);
+void push_frame_at(struct Deserialized *module, int32_t ipc, int32_t local_space, int32_t argc);
+void op_call(struct Deserialized *module, Value callee, int32_t argc);
+void run_call(struct Deserialized *module, int32_t ipc, int32_t local_space, int32_t argc, JitFunction compiled);
+bool memoized_call(struct Deserialized *module, MemoTable *memo, int32_t ipc, int32_t local_space, int32_t argc);
+
+// Moves the arguments on the stack up to pass the closure's environment
+// first, as bytecode calling through the list does.
+void insert_environment(struct Deserialized *module, Closure *closure, int32_t argc);
+void op_native_call(struct Deserialized *module, Value callee, int32_t argc);
+void op_tail_call(struct Deserialized *module, Value callee, int32_t argc);
+
+// Returns the function of a closure passed to a native, and its environment
+// in `env`. Lists of the same shape built by natives are accepted as well.
+FunctionDescriptor decode_closure(struct Deserialized *module, Value func, Value* env);
+
 Value call_function(struct Deserialized *mod, Value callee, int32_t argc, Value* argv);
 Value call_threaded(struct Deserialized *mod, Value callee, int32_t argc, Value* argv);
-Value run_interpreter(struct Deserialized *deserialized, int32_t ipc, bool does_return, int32_t current_callstack);
+Value run_interpreter(struct Deserialized *deserialized, int32_t ipc);
+void translate_bytecode(struct Deserialized *deserialized);
+void print_opcode_pairs(int32_t count);
+
+CallCache* new_call_caches(int32_t count);
+void print_call_cache_stats(struct Deserialized *module);
+bool has_comparison(int32_t kind);
+
+typedef Value (*ComparisonFun)(Value, Value);
+
+// Comparison functions, indexed by the ComparisonKind of comparison
+// instructions.
+extern ComparisonFun comparison_table[];
+
+Value compare_eq(Value a, Value b);
+
+// Add, Sub or Mul of `x` and `y`, of any numeric type (see arithmetic).
+Value generic_arithmetic(struct Deserialized *module, Opcode opcode, Value x, Value y);
+
+// Add, Sub or Mul of `x` and `y`. The common case of 32-bit integers whose
+// result does not overflow is inlined; handlers pass a constant opcode.
+static inline Value arithmetic(struct Deserialized *module, Opcode opcode, Value x, Value y) {
+  int32_t result;
+  bool overflows;
+
+  if (!IS_INT(x) || !IS_INT(y)) return generic_arithmetic(module, opcode, x, y);
+
+  switch (opcode) {
+    case OP_Add: overflows = __builtin_add_overflow((int32_t) x, (int32_t) y, &result); break;
+    case OP_Sub: overflows = __builtin_sub_overflow((int32_t) x, (int32_t) y, &result); break;
+    default: overflows = __builtin_mul_overflow((int32_t) x, (int32_t) y, &result); break;
+  }
+
+  if (overflows) return generic_arithmetic(module, opcode, x, y);
+  return MAKE_INTEGER(result);
+}
+
+Value list_get(Value list, uint32_t idx);
+int32_t constructor_tag(struct Deserialized *module, Value name);
 
 #endif  // INTERPRETER_H
\ No newline at end of file
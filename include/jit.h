@@ -0,0 +1,55 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Baseline compiler for hot functions. Each instruction of a function is
+// replaced by a fixed machine code template, operating on the same stack and
+// frames as the interpreter. Instructions without a template, and operands of
+// unexpected types, leave compiled code at the instruction boundary, and the
+// interpreter runs the rest of the frame from there.
+
+#if defined(__x86_64__) && defined(__linux__)
+#define ENABLE_JIT 1
+#else
+#define ENABLE_JIT 0
+#endif
+
+// Number of calls after which a function is compiled.
+#define JIT_THRESHOLD 1000
+
+// Compiled code calls compiled callees on the C stack. Frames deeper than
+// this are interpreted, in a loop that keeps them on the frame stack only.
+#define JIT_MAX_DEPTH 4096
+
+struct Deserialized;
+
+// Runs the frame that was just entered until it returns.
+typedef void (*JitFunction)(struct Deserialized* module);
+
+typedef struct {
+  // Calls and compiled code of the function starting at each code word.
+  int32_t* call_counts;
+  JitFunction* functions;
+
+  // Bodies of compiled functions, called directly by compiled code.
+  void** entries;
+
+  // Executable mappings, and their sizes.
+  void** blocks;
+  size_t* block_sizes;
+  int32_t block_count;
+} Jit;
+
+// Returns NULL when compilation is not supported on this platform.
+Jit* jit_new(struct Deserialized* module);
+void jit_free(Jit* jit);
+
+// Counts a call to the function starting at `ipc`, and returns its compiled
+// code, compiling it once it is hot. Returns NULL while it is interpreted,
+// and for calls past JIT_MAX_DEPTH.
+JitFunction jit_lookup(struct Deserialized* module, int32_t ipc);
+
+#endif  // JIT_H
@@ -0,0 +1,80 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <value.h>
+
+// Caches of the results of pure functions (see find_pure_functions), keyed
+// on a structural hash of their arguments. Tables are direct-mapped and have
+// a fixed number of entries: a new result replaces the one in its slot.
+
+// Default number of entries of a table (`--memo-size=<n>`).
+#define MEMO_SIZE 1024
+
+// Calls after which a function whose results are rarely reused stops being
+// memoized, and the least fraction of them that must have been hits.
+#define MEMO_PROBATION 4096
+#define MEMO_MIN_HITS (MEMO_PROBATION / 8)
+
+// Misses run the function in a nested interpreter loop, on the C stack, to
+// store its result when it returns. Past this depth of frames, they are
+// ordinary calls, and their results are not stored.
+#define MEMO_MAX_DEPTH 4096
+
+// Elements of lists and characters of strings hashed per argument. Values
+// sharing a prefix only collide, as hits compare whole values.
+#define MEMO_HASH_LIMIT 64
+
+typedef struct {
+  // Number of arguments, fixed by the first call.
+  int32_t argc;
+  int32_t capacity;
+
+  // Hashes of the cached calls, with 0 for empty slots, and their argc
+  // arguments and result. Allocated on the first call.
+  uint64_t* hashes;
+  Value* arguments;
+  Value* results;
+
+  int64_t hits;
+  int64_t misses;
+  int32_t used;
+
+  // Set when the function failed its probation, which frees its entries.
+  bool disabled;
+} MemoTable;
+
+typedef struct {
+  // Table of the pure function starting at each code word, or NULL.
+  MemoTable** tables;
+  int32_t code_length;
+  int32_t capacity;
+} Memo;
+
+// Tables hold values, so they are allocated by the garbage collector.
+Memo* memo_new(int32_t code_length, int32_t capacity);
+
+// Memoizes the function whose entry is at code word `entry`.
+void memo_add(Memo* memo, int32_t entry);
+
+// Table of the function starting at `ipc` while it is memoized, or NULL.
+static inline MemoTable* memo_table(Memo* memo, int32_t ipc) {
+  if (memo == NULL) return NULL;
+
+  MemoTable* table = memo->tables[ipc];
+  return table != NULL && !table->disabled ? table : NULL;
+}
+
+uint64_t memo_hash(Value* args, int32_t argc);
+
+// Finds the result of a call with the same arguments, and counts the lookup.
+bool memo_lookup(MemoTable* table, Value* args, int32_t argc, uint64_t hash, Value* result);
+void memo_store(MemoTable* table, Value* args, int32_t argc, uint64_t hash, Value result);
+
+// Prints the hit rate and size of each table that was used
+// (`--report-memoization`).
+void memo_report(Memo* memo, FILE* out);
+
+#endif  // MEMO_H
@@ -7,6 +7,9 @@
 #include <stdlib.h>
 #include <value.h>
 #include <callstack.h>
+#include <jit.h>
+#include <memo.h>
+#include <profile.h>
 // #include <gc.h>
 
 // #define malloc(size) GC_malloc(size)
@@ -16,17 +19,76 @@
 typedef struct {
   Value* constants;
   int32_t constant_count;
+
+  // Interned strings of the pool, open-addressed by content. The capacity is
+  // a power of two, and empty slots are NULL.
+  HeapValue** strings;
+  int32_t string_capacity;
 } Constants;
 
+// Entry point and number of locals of a function, with an entry per function
+// header of the program.
+typedef struct {
+  int32_t entry;
+  int32_t local_space;
+} FunctionDescriptor;
+
+// Inline cache of a call site: the last function it called, with its decoded
+// entry point and frame size.
+typedef struct {
+  Value callee;
+  int32_t ipc;
+  int32_t local_space;
+
+  // Memo table of the callee, when it is pure.
+  MemoTable* memo;
+
+  // Whether the site has called more than one function.
+  bool megamorphic;
+} CallCache;
+
+// Callee of call sites that were never run. Function values never have bits
+// set above their 32-bit payload.
+#define EMPTY_CALL_CACHE (SIGNATURE_FUNCTION | MASK_PAYLOAD_PTR)
+
 typedef struct Deserialized {
   Libraries libraries;
   
   int32_t instr_count;
   int32_t *instrs;
+  int32_t *code;
+  int32_t code_length;
+
+  // Code word of the Exit instruction.
+  int32_t exit_pc;
+
+  // Opcode of the instruction starting at each code word, for diagnostics.
+  Opcode *opcodes;
+
+  // Functions, indexed by the payload of function values.
+  FunctionDescriptor *functions;
+  int32_t function_count;
+
+  // Maximum operand stack depth of the function starting at each entry.
+  int32_t *stack_depths;
 
   int32_t base_pointer;
   CallStack call_stack;
 
+  // Caches of the CallGlobal and CallLocal sites, indexed by their third
+  // operand in threaded code.
+  CallCache *call_caches;
+  int32_t call_cache_count;
+
+  // Compiled code of hot functions, or NULL when interpreting only.
+  Jit* jit;
+
+  // Results of pure functions, or NULL when they are not memoized.
+  Memo* memo;
+
+  // Counts of the blocks executed, when recording a profile, or NULL.
+  Profile* profile;
+
   Constants constants;
   Stack *stack;
   struct {
@@ -34,6 +96,11 @@ typedef struct Deserialized {
   } *natives;
   DLL* handles;
 
+  // Natives resolved at load time, indexed by the library's offset plus
+  // the function index.
+  Value (**linked_natives)(int argc, struct Deserialized *des, Value *args);
+  int32_t *library_offsets;
+
   int32_t argc;
   Value *argv;
 
@@ -46,6 +113,18 @@ typedef Value (*Native)(int argc, struct Deserialized *m, Value *args);
 
 typedef Deserialized Module;
 
-Frame pop_frame(Deserialized *mod);
+static inline FunctionDescriptor* get_function(Deserialized *mod, Value callee) {
+  return &mod->functions[GET_FUNCTION(callee)];
+}
+
+static inline Frame pop_frame(Deserialized *mod) {
+  return mod->call_stack.frames[--mod->call_stack.frame_pointer];
+}
+
+char* GetDirname(char* path);
+
+// Loads the native libraries of the module, looking up relative paths in
+// `dir`.
+void load_libraries(Deserialized *des, char *dir);
 
 #endif  // MODULE_H
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef PASSES_H
+#define PASSES_H
+
+#include <bytecode.h>
+#include <module.h>
+
+// Load-time passes over decoded bytecode. They run before the bytecode is
+// translated into threaded code, and never change the on-disk format.
+
+void verify_bytecode(Deserialized* module, Bytecode* bytecode);
+
+// Optimizations of verified bytecode, each of which can be disabled from the
+// command line with `--no-<name>` (see parse_optimization_flag).
+typedef struct {
+  bool inline_functions;
+  bool tag_constructors;
+  bool build_switches;
+  bool fold_constants;
+  bool thread_jumps;
+  bool remove_unreachable;
+  bool remove_redundant_locals;
+  bool memoize;
+
+  // Largest function body inlined, in instructions
+  // (`--inline-threshold=<n>`), and whether inlined functions are reported
+  // on stderr (`--report-inlining`).
+  int32_t inline_threshold;
+  bool report_inlining;
+
+  // Entries of the memo table of each pure function (`--memo-size=<n>`),
+  // and whether their use is reported on stderr on exit
+  // (`--report-memoization`).
+  int32_t memo_size;
+  bool report_memoization;
+
+  // Files to which the execution counts of blocks are written on exit
+  // (`--write-profile=<file>`), and from which they are read to lay out hot
+  // code (`--use-profile=<file>`), or NULL.
+  const char* write_profile;
+  const char* use_profile;
+} Optimizations;
+
+extern Optimizations optimizations;
+
+// Applies an optimization flag, such as `--no-inline`. Returns false when
+// `arg` is not one.
+bool parse_optimization_flag(const char* arg);
+
+// Inlines functions of at most `threshold` instructions into their callers.
+void inline_functions(Bytecode* bytecode, int32_t threshold, bool verbose);
+
+// Index of `value` in the constant pool, which grows when it is missing.
+int32_t find_constant(Deserialized* module, Value value);
+
+// Compares constructor names by the tags of the interned strings of the
+// constant pool, instead of as strings.
+void tag_constructors(Deserialized* module, Bytecode* bytecode);
+
+// Replaces chains of comparisons of a value against integer constants with
+// Switch instructions.
+void build_switches(Deserialized* module, Bytecode* bytecode);
+
+// Rewrites the bytecode, dropping the instructions it makes useless. Folded
+// constants are added to the module's constant pool.
+void optimize_bytecode(Deserialized* module, Bytecode* bytecode);
+
+// Finds the functions whose result only depends on their arguments, which
+// are memoized. Returns whether each function is pure, in the order of their
+// headers. Runs on stack bytecode.
+bool* find_pure_functions(Bytecode* bytecode);
+
+// Orders the instructions of the bytecode for layout, with hot functions and
+// blocks first according to the execution `counts` of a profile, or in their
+// original order when it is NULL. Writes the instructions that are not
+// covered by fused ones to `order`, and returns their number.
+int32_t order_instructions(Bytecode* bytecode, uint64_t* counts, int32_t* order);
+
+void fuse_superinstructions(Bytecode* bytecode);
+void link_natives(Deserialized* module, Bytecode* bytecode);
+void detect_tail_calls(Bytecode* bytecode);
+int32_t* compute_stack_depths(Bytecode* bytecode, int32_t* instruction_depths);
+void translate_registers(Bytecode* bytecode, int32_t* depths, int32_t** stack_depths);
+
+#endif  // PASSES_H
@@ -0,0 +1,34 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <bytecode.h>
+#include <stdint.h>
+
+// Execution counts of the blocks of a program, recorded by one run
+// (`--write-profile=<file>`) and used to lay out the threaded code of later
+// ones (`--use-profile=<file>`, see order_instructions). Blocks are
+// identified by their first instruction in the bytecode that is laid out,
+// which is the same on every run of the program with the same optimizations.
+
+typedef struct {
+  // Executions of the block starting at each instruction, 0 for the others.
+  uint64_t* counts;
+  int32_t instruction_count;
+
+  // Hash of the instructions, which must match for the counts to apply.
+  uint64_t checksum;
+} Profile;
+
+Profile* profile_new(Bytecode* bytecode);
+
+// Reads the profile of `bytecode` from `path`. Returns NULL with a warning
+// when it is missing, or was recorded for other bytecode.
+Profile* profile_read(const char* path, Bytecode* bytecode);
+
+// Writes the non-zero counts as `<instruction> <count>` lines, after a
+// header line.
+void profile_write(Profile* profile, const char* path);
+
+void profile_free(Profile* profile);
+
+#endif  // PROFILE_H
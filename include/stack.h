@@ -8,6 +8,7 @@
 Stack *stack_new();
 void stack_free(Stack *stack);
 void stack_resize(Stack *st);
+void stack_reserve(Stack *st, int32_t n);
 
 #define DOES_OVERFLOW(stack, n) stack->stack_pointer + n >= stack->capacity
 #define DOES_UNDERFLOW(stack, n) stack->stack_pointer - n < BASE_POINTER
@@ -68,6 +68,7 @@ typedef enum {
   TYPE_UNKNOWN,
   TYPE_API,
   TYPE_THREAD,
+  TYPE_INT64,
 } ValueType;
 
 // Container for arrays
@@ -87,14 +88,34 @@ typedef struct {
   uint32_t length;
   bool is_marked;
 
+  // Tag of strings interned from the constant pool, or of the equal constant
+  // for strings built at runtime once looked up (NO_CONSTANT_TAG when there
+  // is none), CLOSURE_TAG for closures, or 0.
+  int32_t tag;
+
   union {
     char* as_string;
     Value* as_ptr;
     void* as_any;
     thread_t as_thread;
+    int64_t as_int64;
   };
 } HeapValue;
 
+// Closures are the lists [environment, function] that bytecode builds for
+// functions with an environment, and reads with ListGet. They are allocated
+// in one block with their values and the entry of their function, which
+// calls through them use without decoding the list.
+typedef struct {
+  HeapValue header;
+  int32_t entry;
+  int32_t local_space;
+  Value values[2];
+} Closure;
+
+#define CLOSURE_TAG -1
+#define NO_CONSTANT_TAG -2
+
 #define GLOBALS_SIZE 1024
 #define MAX_STACK_SIZE GLOBALS_SIZE * 32
 #define VALUE_STACK_SIZE MAX_STACK_SIZE - GLOBALS_SIZE
@@ -104,7 +125,7 @@ typedef struct {
 
 typedef struct {
   Value *values;
-  int16_t stack_pointer;
+  int32_t stack_pointer;
   int32_t capacity;
 } Stack;
 
@@ -112,15 +133,24 @@ typedef struct {
 #define MAKE_FLOAT(x) (*(Value*)(&(x)))
 #define MAKE_PTR(x) (SIGNATURE_POINTER | (uint64_t)(x))
 
-#define MAKE_FUNCTION(x, y) \
-  (SIGNATURE_FUNCTION | (uint16_t)(x) | ((uint16_t)(y) << 16))
-#define MAKE_FUNCENV(pc, sp, bp)                                 \
-  (SIGNATURE_FUNCENV | (uint64_t)(pc) | ((uint64_t)(sp) << 16) | \
-   ((uint64_t)(bp) << 32))
+// Functions are indices into the descriptor table of their module (see
+// FunctionDescriptor).
+#define MAKE_FUNCTION(x) (SIGNATURE_FUNCTION | (uint32_t)(x))
 
 Value MAKE_MUTABLE(Stack* gc, Value x);
 Value MAKE_STRING(Stack* gc, char* x);
 Value MAKE_LIST(Stack* gc, Value* x, uint32_t length);
+Value MAKE_CONSTRUCTOR(Stack* gc, Value* fields, uint32_t length);
+Value MAKE_CLOSURE(Stack* gc, Value* items, int32_t entry, int32_t local_space);
+
+// Integers are 32-bit, and the results of arithmetic that do not fit are
+// boxed on the heap. Those that fit are never boxed, so that every integer
+// has a single representation.
+Value MAKE_INT64(Stack* gc, int64_t x);
+
+// Values of algebraic data types are lists starting with a special value.
+#define IS_CONSTRUCTOR(items, length) ((length) > 0 && (items)[0] == kNull)
+#define IS_CLOSURE(items, length) ((length) == 2 && IS_FUN((items)[1]))
 
 #define MAKE_SPECIAL() kNull
 #define MAKE_ADDRESS(x) MAKE_INTEGER(x)
@@ -135,10 +165,16 @@ Value MAKE_LIST(Stack* gc, Value* x, uint32_t length);
 #define GET_FLOAT(x) (*(double*)(&(x)))
 #define GET_ADDRESS(x) GET_INT(x)
 #define GET_NATIVE(x) GET_STRING(x)
-#define GET_NTH_ELEMENT(x, n) ((x >> (n * 16)) & MASK_PAYLOAD_INT)
+#define GET_FUNCTION(x) GET_INT(x)
 
 #define IS_PTR(x) (((x) & MASK_SIGNATURE) == SIGNATURE_POINTER)
 #define IS_FUN(x) (((x) & MASK_SIGNATURE) == SIGNATURE_FUNCTION)
+#define IS_INT(x) (((x) & MASK_SIGNATURE) == SIGNATURE_INTEGER)
+#define IS_FLOAT(x) ((~(x) & MASK_EXPONENT) != 0)
+#define IS_INT64(x) (IS_PTR(x) && GET_PTR(x)->type == TYPE_INT64)
+#define IS_INTEGER(x) (IS_INT(x) || IS_INT64(x))
+
+#define GET_INT64(x) (IS_INT(x) ? (int64_t) (int32_t) GET_INT(x) : GET_PTR(x)->as_int64)
 
 static inline ValueType get_type(Value value) {
   uint64_t signature = value & MASK_SIGNATURE;
@@ -167,9 +203,17 @@ static inline ValueType get_type(Value value) {
   return TYPE_UNKNOWN;
 }
 
-static inline char* type_of(Value value) {
-  switch (get_type(value)) {
-    case TYPE_INTEGER:
+// Returns NULL when the value is not a closure.
+static inline Closure* get_closure(Value value) {
+  if (!IS_PTR(value)) return NULL;
+
+  HeapValue* ptr = GET_PTR(value);
+  return ptr->type == TYPE_LIST && ptr->tag == CLOSURE_TAG ? (Closure*) ptr : NULL;
+}
+
+static inline char* type_name(ValueType type) {
+  switch (type) {
+    case TYPE_INTEGER: case TYPE_INT64:
       return "integer";
     case TYPE_FUNCTION:
       return "function";
@@ -192,8 +236,26 @@ static inline char* type_of(Value value) {
     case TYPE_THREAD:
       return "thread";
   }
+
+  return "unknown";
 }
 
+static inline char* type_of(Value value) {
+  return type_name(get_type(value));
+}
+
+#define VALUE_TYPE_COUNT (TYPE_INT64 + 1)
+
+// Immortal values, in static storage, which are shared wherever they are
+// made instead of being allocated (see init_values). Unit is the
+// constructor [special, "unit", "unit"], and type names are the strings of
+// type_name, indexed by type.
+extern Value unit_value;
+extern Value empty_list;
+extern Value type_names[VALUE_TYPE_COUNT];
+
+void init_values(void);
+
 HeapValue* allocate(Stack* st, ValueType type, size_t size);
 
 #endif  // VALUE_H
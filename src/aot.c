@@ -0,0 +1,124 @@
+#include <aot.h>
+#include <bytecode.h>
+#include <deserializer.h>
+#include <passes.h>
+#include <stdio.h>
+
+static AotFunction* functions = NULL;
+
+void aot_run(Deserialized *module, int32_t ipc) {
+  while (ipc >= 0) {
+    ASSERT_FMT(functions[ipc] != NULL, "No compiled function at %d", ipc);
+    ipc = functions[ipc](module);
+  }
+}
+
+void aot_call(Deserialized *module, Value callee, int32_t argc) {
+  ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+  Closure* closure = get_closure(callee);
+  if (closure != NULL) {
+    insert_environment(module, closure, argc);
+    push_frame_at(module, closure->entry, closure->local_space, argc + 1);
+    aot_run(module, module->pc);
+    return;
+  }
+
+  if (!IS_FUN(callee)) {
+    op_native_call(module, callee, argc);
+    return;
+  }
+
+  push_frame(module, callee, argc);
+  aot_run(module, module->pc);
+}
+
+// Same as call_function, running the compiled callee instead.
+Value aot_call_function(Deserialized *module, Value func, int32_t argc, Value* argv) {
+  Value func_env;
+  FunctionDescriptor function = decode_closure(module, func, &func_env);
+
+  stack_push(module->stack, func_env);
+  for (int i = 0; i < argc - 1; i++) {
+    stack_push(module->stack, argv[i]);
+  }
+
+  push_frame_at(module, function.entry, function.local_space, argc);
+  aot_run(module, module->pc);
+
+  return stack_pop(module->stack);
+}
+
+int aot_main(int argc, char **argv, const uint8_t *bytecode, size_t size, AotFunction *compiled) {
+  GC_init();
+  init_values();
+
+  Stack* st = stack_new();
+
+  Value* values = GC_malloc(sizeof(Value) * argc);
+  for (int i = 0; i < argc; i++) {
+    values[i] = MAKE_STRING(st, argv[i]);
+  }
+
+  // The deserializer reads from a file.
+  FILE* file = tmpfile();
+  if (file == NULL) THROW("Could not create temporary file");
+
+  fwrite(bytecode, 1, size, file);
+  rewind(file);
+
+  Deserialized des = deserialize(file, st);
+  fclose(file);
+
+  des.argc = argc;
+  des.argv = values;
+  des.jit = NULL;
+  des.memo = NULL;
+  des.profile = NULL;
+  des.call_caches = NULL;
+  des.call_cache_count = 0;
+  des.call_function = aot_call_function;
+
+  // Threads share the stack of their caller.
+  des.call_threaded = aot_call_function;
+
+  load_libraries(&des, GetDirname(GC_strdup(argv[0])));
+
+  // Frames reserve the same stack depths as in the interpreter, computed on
+  // the bytecode plume-aot compiled.
+  Bytecode decoded = decode_bytecode(des.instrs, des.instr_count);
+  verify_bytecode(&des, &decoded);
+  optimize_bytecode(&des, &decoded);
+  detect_tail_calls(&decoded);
+
+  int32_t* depths = malloc((decoded.instruction_count + 1) * sizeof(int32_t));
+  des.stack_depths = compute_stack_depths(&decoded, depths);
+  free(depths);
+
+  // Functions are numbered in the order of their headers, as by plume-aot,
+  // and entered at the instruction following them.
+  des.functions = malloc((decoded.instruction_count + 1) * sizeof(FunctionDescriptor));
+  des.function_count = 0;
+
+  for (int32_t i = 0; i < decoded.instruction_count; i++) {
+    Instruction instr = decoded.instructions[i];
+
+    if (instr.opcode == OP_MakeLambda) {
+      des.functions[des.function_count++] = (FunctionDescriptor) { i + 1, instr.operand2 };
+    } else if (instr.opcode == OP_MakeAndStoreLambda) {
+      des.functions[des.function_count++] = (FunctionDescriptor) { i + 1, instr.operand3 };
+    }
+  }
+
+  free(decoded.instructions);
+
+  functions = compiled;
+  aot_run(&des, 0);
+
+  stack_free(st);
+  free(des.instrs);
+  free(des.stack_depths);
+  free(des.functions);
+
+  return 0;
+}
@@ -0,0 +1,236 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <value.h>
+
+Bytecode decode_bytecode(int32_t* raw, int32_t instr_count) {
+  Bytecode bytecode;
+  bytecode.instruction_count = instr_count;
+  bytecode.instructions = malloc(instr_count * sizeof(Instruction));
+
+  for (int32_t i = 0; i < instr_count; i++) {
+    int32_t opcode = raw[i * 4];
+
+    ASSERT_FMT(opcode >= 0 && opcode < SERIALIZED_OPCODE_COUNT,
+               "Unknown opcode %d at instruction %d", opcode, i);
+
+    bytecode.instructions[i] = (Instruction) {
+      opcode, raw[i * 4 + 1], raw[i * 4 + 2], raw[i * 4 + 3], 0
+    };
+  }
+
+  return bytecode;
+}
+
+int32_t jump_target(Instruction* instrs, int32_t idx) {
+  Instruction instr = instrs[idx];
+
+  switch (instr.opcode) {
+    case OP_JumpRel: case OP_JumpElseRel: case OP_JumpElseRelCmp:
+    case OP_JumpElseRelCmpConst: case OP_IJumpElseRelCmpConst:
+    case OP_RJumpElseRel: case OP_RJumpElseRelCmp: case OP_RIJumpElseRelCmp:
+    case OP_RJumpElseRelCmpConst: case OP_RIJumpElseRelCmpConst:
+    case OP_Switch: case OP_SwitchSparse: case OP_SwitchCase:
+      return idx + instr.operand1;
+    case OP_IJumpElseRelCmp:
+      return idx + instr.operand2;
+    case OP_MakeLambda:
+      return idx + instr.operand1 + 1;
+    case OP_MakeAndStoreLambda:
+      return idx + instr.operand2 + 1;
+    default:
+      return -1;
+  }
+}
+
+void set_jump_target(Instruction* instrs, int32_t idx, int32_t target) {
+  Instruction* instr = &instrs[idx];
+
+  switch (instr->opcode) {
+    case OP_JumpRel: case OP_JumpElseRel: case OP_JumpElseRelCmp:
+    case OP_JumpElseRelCmpConst: case OP_IJumpElseRelCmpConst:
+    case OP_RJumpElseRel: case OP_RJumpElseRelCmp: case OP_RIJumpElseRelCmp:
+    case OP_RJumpElseRelCmpConst: case OP_RIJumpElseRelCmpConst:
+    case OP_Switch: case OP_SwitchSparse: case OP_SwitchCase:
+      instr->operand1 = target - idx;
+      break;
+    case OP_IJumpElseRelCmp:
+      instr->operand2 = target - idx;
+      break;
+    case OP_MakeLambda:
+      instr->operand1 = target - idx - 1;
+      break;
+    case OP_MakeAndStoreLambda:
+      instr->operand2 = target - idx - 1;
+      break;
+    default:
+      THROW_FMT("Instruction %d does not jump", idx);
+  }
+}
+
+int32_t stack_effect(Instruction* instrs, int32_t idx) {
+  Instruction instr = instrs[idx];
+
+  switch (instr.opcode) {
+    case OP_LoadLocal: case OP_LoadConstant: case OP_LoadGlobal:
+    case OP_MakeLambda: case OP_Special: case OP_LoadLocalAddConst:
+    case OP_LoadLocalSubConst: case OP_LoadLocalListGet:
+    case OP_AddLocals: case OP_SubLocals: case OP_MulLocals:
+      return 1;
+    case OP_LoadLocal2:
+      return 2;
+    case OP_LoadNative:
+      return 3;
+    case OP_StoreLocal: case OP_StoreGlobal: case OP_Compare: case OP_And:
+    case OP_Or: case OP_JumpElseRel: case OP_GetIndex: case OP_Add:
+    case OP_Sub: case OP_Mul: case OP_Return: case OP_JumpElseRelCmpConst:
+    case OP_IJumpElseRelCmpConst: case OP_Switch: case OP_SwitchSparse:
+      return -1;
+    case OP_Update: case OP_JumpElseRelCmp: case OP_IJumpElseRelCmp:
+      return -2;
+    case OP_MakeList:
+      return 1 - instr.operand1;
+    case OP_Call: case OP_TailCall:
+      // A native callee also pops the two library indices pushed by
+      // LoadNative.
+      if (idx > 0 && instrs[idx - 1].opcode == OP_LoadNative)
+        return -2 - instr.operand1;
+      return -instr.operand1;
+    case OP_CallGlobal: case OP_CallLocal: case OP_CallNative:
+    case OP_TailCallGlobal: case OP_TailCallLocal:
+      return 1 - instr.operand2;
+    default:
+      return 0;
+  }
+}
+
+bool falls_through(Instruction* instr) {
+  switch (instr->opcode) {
+    // Switches fall through into their table, and each entry but the last
+    // into the next one, so that passes following jumps and fall-through
+    // reach every case. The last entry has a zero third operand.
+    case OP_SwitchCase:
+      return instr->operand3 != 0;
+    case OP_Return: case OP_ReturnConst: case OP_ReturnUnit: case OP_Halt:
+    case OP_JumpRel: case OP_MakeLambda: case OP_MakeAndStoreLambda:
+    case OP_RReturn:
+      return false;
+    default:
+      return true;
+  }
+}
+
+int32_t instruction_size(Instruction* instr) {
+  switch (instr->opcode) {
+    case OP_AddLocals: case OP_SubLocals: case OP_MulLocals:
+    case OP_AddConstLocal: case OP_SubConstLocal:
+      return 3;
+    case OP_LoadLocal2: case OP_LoadLocalAddConst: case OP_LoadLocalSubConst:
+    case OP_LoadLocalListGet: case OP_CallNative:
+      return 2;
+    default:
+      return 1;
+  }
+}
+
+bool* find_jump_targets(Bytecode* bytecode) {
+  bool* targets = calloc(bytecode->instruction_count + 1, sizeof(bool));
+
+  for (int32_t i = 0; i < bytecode->instruction_count; i++) {
+    int32_t target = jump_target(bytecode->instructions, i);
+    if (target < 0) continue;
+
+    ASSERT_FMT(target <= bytecode->instruction_count,
+               "Jump target %d out of bounds at instruction %d", target, i);
+    targets[target] = true;
+  }
+
+  return targets;
+}
+
+void remove_instructions(Bytecode* bytecode, bool* removed) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  int32_t* positions = malloc((count + 1) * sizeof(int32_t));
+
+  int32_t length = 0;
+  for (int32_t i = 0; i < count; i++) {
+    positions[i] = length;
+    if (!removed[i]) length++;
+  }
+  positions[count] = length;
+
+  length = 0;
+  for (int32_t i = 0; i < count; i++) {
+    if (removed[i]) continue;
+
+    Instruction instr = instrs[i];
+    int32_t target = jump_target(instrs, i);
+
+    instrs[length] = instr;
+    if (target >= 0) set_jump_target(instrs, length, positions[target]);
+    length++;
+  }
+
+  bytecode->instruction_count = length;
+  free(positions);
+}
+
+static void assign_owners(Instruction* instrs, int32_t entry, int32_t end, int32_t* owners) {
+  int32_t i = entry;
+
+  while (i < end) {
+    owners[i] = entry;
+
+    Opcode opcode = instrs[i].opcode;
+    if (opcode == OP_MakeLambda || opcode == OP_MakeAndStoreLambda) {
+      int32_t body_end = jump_target(instrs, i);
+      assign_owners(instrs, i + 1, body_end, owners);
+      i = body_end;
+    } else {
+      i++;
+    }
+  }
+}
+
+void find_owners(Bytecode* bytecode, int32_t* owners) {
+  assign_owners(bytecode->instructions, 0, bytecode->instruction_count, owners);
+}
+
+// Locals of the top level alias globals, so their stores count too.
+void find_definitions(Bytecode* bytecode, int32_t* owners, int32_t* definitions) {
+  Instruction* instrs = bytecode->instructions;
+
+  for (int32_t g = 0; g < GLOBALS_SIZE; g++) definitions[g] = -1;
+
+  bool* stored = calloc(GLOBALS_SIZE, sizeof(bool));
+
+  for (int32_t i = 0; i < bytecode->instruction_count; i++) {
+    int32_t global;
+
+    switch (instrs[i].opcode) {
+      case OP_MakeAndStoreLambda:
+        global = instrs[i].operand1;
+        if (!stored[global]) definitions[global] = i;
+        else definitions[global] = -1;
+        break;
+      case OP_StoreGlobal:
+        global = instrs[i].operand1;
+        definitions[global] = -1;
+        break;
+      case OP_StoreLocal:
+        if (owners[i] != 0) continue;
+        global = GLOBALS_SIZE + instrs[i].operand1;
+        definitions[global] = -1;
+        break;
+      default:
+        continue;
+    }
+
+    stored[global] = true;
+  }
+
+  free(stored);
+}
@@ -0,0 +1,26 @@
+#include <callstack.h>
+#include <core/error.h>
+#include <stdlib.h>
+
+void callstack_init(CallStack *callstack) {
+  callstack->frame_pointer = 0;
+  callstack->capacity = FRAME_CHUNK;
+  callstack->frames = malloc(FRAME_CHUNK * sizeof(Frame));
+}
+
+// Recursion depth is only bounded by memory.
+void callstack_grow(CallStack *callstack) {
+  int32_t capacity = callstack->capacity > 0 ? callstack->capacity * 2 : FRAME_CHUNK;
+  Frame* frames = realloc(callstack->frames, capacity * sizeof(Frame));
+
+  if (frames == NULL) THROW_FMT("Call stack overflow, reached %d", callstack->frame_pointer);
+
+  callstack->capacity = capacity;
+  callstack->frames = frames;
+}
+
+void callstack_free(CallStack *callstack) {
+  free(callstack->frames);
+  callstack->frames = NULL;
+  callstack->capacity = 0;
+}
@@ -55,6 +55,58 @@ Value deserialize_value(FILE* file, Stack* st) {
   return value;
 }
 
+static uint32_t hash_string(char* string) {
+  uint32_t hash = 2166136261u;
+  for (; *string != '\0'; string++) hash = (hash ^ (uint8_t) *string) * 16777619u;
+  return hash;
+}
+
+// The slot holding the interned string equal to `string`, or the empty slot
+// where it goes.
+static HeapValue** string_slot(Constants* constants, char* string) {
+  uint32_t mask = constants->string_capacity - 1;
+
+  for (uint32_t slot = hash_string(string) & mask;; slot = (slot + 1) & mask) {
+    HeapValue* interned = constants->strings[slot];
+    if (interned == NULL || strcmp(interned->as_string, string) == 0) {
+      return &constants->strings[slot];
+    }
+  }
+}
+
+HeapValue* find_string_constant(Constants* constants, char* string) {
+  return *string_slot(constants, string);
+}
+
+// Equal strings of the constant pool share one heap value, which carries a
+// small integer tag. Constructor names are strings, so matching on them
+// compares tags (see OP_ConstructorTag).
+static void intern_strings(Constants* constants) {
+  // At most half full, so that probes stay short.
+  int32_t capacity = 1;
+  while (capacity < 2 * constants->constant_count) capacity *= 2;
+
+  constants->strings = GC_malloc(capacity * sizeof(HeapValue*));
+  memset(constants->strings, 0, capacity * sizeof(HeapValue*));
+  constants->string_capacity = capacity;
+
+  int32_t tags = 0;
+
+  for (int32_t i = 0; i < constants->constant_count; i++) {
+    Value value = constants->constants[i];
+    if (get_type(value) != TYPE_STRING) continue;
+
+    HeapValue** slot = string_slot(constants, GET_STRING(value));
+
+    if (*slot != NULL) {
+      constants->constants[i] = MAKE_PTR(*slot);
+    } else {
+      *slot = GET_PTR(value);
+      (*slot)->tag = ++tags;
+    }
+  }
+}
+
 Constants deserialize_constants(FILE* file, Stack *st) {
   Constants constants;
 
@@ -70,6 +122,7 @@ Constants deserialize_constants(FILE* file, Stack *st) {
 
   assert(constants.constants != NULL);
 
+  intern_strings(&constants);
   return constants;
 }
 
@@ -126,7 +179,11 @@ Deserialized deserialize(FILE* file, Stack* st) {
   deserialized.instrs = instrs;
   deserialized.constants = constants_;
   deserialized.stack = st;
-  deserialized.call_stack.frame_pointer = 0;
+  deserialized.pc = 0;
+  deserialized.base_pointer = st->stack_pointer;
+  callstack_init(&deserialized.call_stack);
+  deserialized.memo = NULL;
+  deserialized.profile = NULL;
   deserialized.natives = GC_malloc(libraries.num_libraries * sizeof(Native));
   deserialized.call_function = call_function;
   deserialized.call_threaded = call_threaded;
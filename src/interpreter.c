@@ -4,17 +4,91 @@
 #include <core/debug.h>
 #include <core/error.h>
 #include <core/library.h>
+#include <deserializer.h>
 #include <interpreter.h>
+#include <jit.h>
 #include <module.h>
+#include <passes.h>
 #include <stack.h>
 #include <stdio.h>
+#include <string.h>
 #include <value.h>
 #include <gc.h>
 
-#define INCREASE_IP_BY(mod, x) (mod->pc += ((x) * 4))
-#define INCREASE_IP(mod) INCREASE_IP_BY(mod, 1)
+#define INCREASE_IP_BY(x) (pc += (x))
+
+// Handlers know their opcode, so the length of the instruction folds to a
+// constant.
+#define INCREASE_IP(opcode) INCREASE_IP_BY(code_words(opcode))
+
+// Handler offsets in threaded code are relative to the first handler of
+// run_interpreter.
+#define DISPATCH_BASE ((char*) &&case_load_local)
+
+#if DEBUG
+#define DISPATCH()                                              \
+  do {                                                          \
+    int32_t opcode_ = module->opcodes[pc - bytecode];           \
+    opcode_pairs[last_opcode][opcode_]++;                       \
+    last_opcode = opcode_;                                      \
+    executed_instructions++;                                    \
+    goto *(DISPATCH_BASE + *pc);                                \
+  } while (0)
+#else
+#define DISPATCH() goto *(DISPATCH_BASE + *pc)
+#endif
+
+// Quickening: generic arithmetic and comparison handlers record the operand
+// types they see by rewriting their own handler offset to a specialized
+// handler. The specialized handler only performs a cheap tag test, and rewrites
+// it back to the generic handler when it sees other types.
+#define QUICKEN(label) (*pc = (char*) &&label - DISPATCH_BASE)
 
 int halt = 0;
+uint64_t executed_instructions = 0;
+
+// Dynamic counts of consecutive executed opcodes, used to pick the
+// sequences fused into superinstructions.
+uint64_t opcode_pairs[OPCODE_COUNT][OPCODE_COUNT];
+
+#if DEBUG
+static int32_t last_opcode = 0;
+#endif
+
+void print_opcode_pairs(int32_t count) {
+  bool seen[OPCODE_COUNT][OPCODE_COUNT] = { 0 };
+
+  for (int32_t n = 0; n < count; n++) {
+    int32_t best_a = 0, best_b = 0;
+    uint64_t best = 0;
+
+    for (int32_t a = 0; a < OPCODE_COUNT; a++) {
+      for (int32_t b = 0; b < OPCODE_COUNT; b++) {
+        if (!seen[a][b] && opcode_pairs[a][b] > best) {
+          best = opcode_pairs[a][b];
+          best_a = a;
+          best_b = b;
+        }
+      }
+    }
+
+    if (best == 0) break;
+    seen[best_a][best_b] = true;
+    printf("Opcode pair %d -> %d: %llu\n", best_a, best_b, (unsigned long long) best);
+  }
+}
+
+// Handler addresses of run_interpreter, exported by calling it with a NULL
+// module.
+static void** dispatch_table = NULL;
+
+// Constants are inlined in threaded code, where they are only aligned on
+// words.
+static inline Value read_constant(int32_t* words) {
+  Value value;
+  memcpy(&value, words, sizeof(Value));
+  return value;
+}
 
 Value list_get(Value list, uint32_t idx) {
   HeapValue* l = GET_PTR(list);
@@ -23,38 +97,57 @@ Value list_get(Value list, uint32_t idx) {
   return l->as_ptr[idx];
 }
 
-Value call_function(Deserialized *module, Value func, int32_t argc, Value* argv) {
-  ASSERT_FMT(module->call_stack.frame_pointer < MAX_FRAMES, "Call stack overflow, reached %d", module->call_stack.frame_pointer);
-  
-  Value func_env = list_get(func, 0);
-  Value callee   = list_get(func, 1);
+// Strings from the constant pool carry their tag. Others, built at runtime,
+// take the tag of an equal constant, or 0 when there is none, and keep it.
+int32_t constructor_tag(Deserialized *module, Value name) {
+  ASSERT(get_type(name) == TYPE_STRING, "Expected string");
 
-  stack_push(module->stack, func_env);
-  for (int i = 0; i < argc - 1; i++) {
-    stack_push(module->stack, argv[i]);
+  HeapValue* string = GET_PTR(name);
+
+  if (string->tag == 0) {
+    HeapValue* constant = find_string_constant(&module->constants, string->as_string);
+    string->tag = constant != NULL ? constant->tag : NO_CONSTANT_TAG;
   }
 
-  int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
-  int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
-  int16_t old_sp = module->stack->stack_pointer - argc;
+  return string->tag == NO_CONSTANT_TAG ? 0 : string->tag;
+}
 
-  module->stack->stack_pointer += local_space - argc;
+FunctionDescriptor decode_closure(Deserialized *module, Value func, Value* env) {
+  Closure* closure = get_closure(func);
 
-  int32_t new_pc = module->pc + 4;
+  if (closure != NULL) {
+    *env = closure->values[0];
+    return (FunctionDescriptor) { closure->entry, closure->local_space };
+  }
 
-  stack_push(module->stack, MAKE_FUNCENV(new_pc, old_sp, module->base_pointer));
+  *env = list_get(func, 0);
+  return *get_function(module, list_get(func, 1));
+}
 
-  module->base_pointer = module->stack->stack_pointer - 1;
-  module->call_stack.frame_pointer++;
+// Runs a call made from C until it returns, with its result pushed. Pure
+// functions share results.
+static void complete_call(Deserialized *module, int32_t ipc, int32_t local_space, int32_t argc) {
+  MemoTable* memo = memo_table(module->memo, ipc);
 
-  Value ret = run_interpreter(module, ipc, true, module->call_stack.frame_pointer - 1);
+  if (memo == NULL || !memoized_call(module, memo, ipc, local_space, argc)) {
+    run_call(module, ipc, local_space, argc, NULL);
+  }
+}
 
-  // Removing an instruction to program counter because of native calls:
-  // They increase automatically the program counter by 4, and we don't want to
-  // mis-interpret bytecode.
-  module->pc -= 4;
+Value call_function(Deserialized *module, Value func, int32_t argc, Value* argv) {
+  Value func_env;
+  FunctionDescriptor function = decode_closure(module, func, &func_env);
 
-  return ret;
+  stack_push(module->stack, func_env);
+  for (int i = 0; i < argc - 1; i++) {
+    stack_push(module->stack, argv[i]);
+  }
+
+  complete_call(module, function.entry, function.local_space, argc);
+
+  // The result goes back to the native. Operand stack depths are static, so
+  // it must not stay on the stack.
+  return stack_pop(module->stack);
 }
 
 Value call_threaded(Deserialized *module, Value func, int32_t argc, Value* argv) {
@@ -62,55 +155,69 @@ Value call_threaded(Deserialized *module, Value func, int32_t argc, Value* argv)
   new_module->stack = stack_new();
 
   // Copy old stack to new stack
+  stack_reserve(new_module->stack, module->stack->stack_pointer - new_module->stack->stack_pointer);
   for (int i = 0; i < module->stack->stack_pointer; i++) {
     new_module->stack->values[i] = module->stack->values[i];
   }
 
-  Value func_env = list_get(func, 0);
-  Value callee   = list_get(func, 1);
+  Value func_env;
+  FunctionDescriptor function = decode_closure(module, func, &func_env);
 
   stack_push(new_module->stack, func_env);
   for (int i = 0; i < argc - 1; i++) {
     stack_push(new_module->stack, argv[i]);
   }
 
-  int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
-  int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
-  int16_t old_sp = new_module->stack->stack_pointer - argc;
-
-  new_module->stack->stack_pointer += local_space - argc;
-
-  int32_t new_pc = module->pc + 4;
-
-  stack_push(new_module->stack, MAKE_FUNCENV(new_pc, old_sp, module->base_pointer));
-
-  new_module->base_pointer = new_module->stack->stack_pointer - 1;
-  new_module->call_stack.frame_pointer++;
+  callstack_init(&new_module->call_stack);
+  new_module->base_pointer = module->base_pointer;
+  new_module->pc = module->pc;
 
   new_module->instr_count = module->instr_count;
   new_module->instrs = module->instrs;
+  new_module->code = module->code;
+  new_module->code_length = module->code_length;
+  new_module->exit_pc = module->exit_pc;
+  new_module->opcodes = module->opcodes;
+  new_module->functions = module->functions;
+  new_module->function_count = module->function_count;
+  new_module->stack_depths = module->stack_depths;
   new_module->constants = module->constants;
   new_module->natives = module->natives;
+  new_module->linked_natives = module->linked_natives;
+  new_module->library_offsets = module->library_offsets;
   new_module->handles = module->handles;
   new_module->argc = module->argc;
   new_module->argv = module->argv;
   new_module->call_function = call_function;
   new_module->call_threaded = call_threaded;
 
-  // module->pc = new_pc;
+  // Compiled code is bound to the module it was compiled for, and caches
+  // are not shared between threads.
+  new_module->jit = NULL;
+  new_module->memo = NULL;
+  new_module->call_caches = new_call_caches(module->call_cache_count);
+  new_module->call_cache_count = module->call_cache_count;
+
+  // Counts are shared, and may miss increments made concurrently.
+  new_module->profile = module->profile;
+
+  run_call(new_module, function.entry, function.local_space, argc, NULL);
+  Value ret = stack_pop(new_module->stack);
 
-  Value ret = run_interpreter(new_module, ipc, true, new_module->call_stack.frame_pointer - 1);
-  
   stack_free(new_module->stack);
+  callstack_free(&new_module->call_stack);
+  free(new_module->call_caches);
 
   return ret;
 }
 
 
-typedef Value (*ComparisonFun)(Value, Value);
-
 Value compare_eq(Value a, Value b) {
   ValueType a_type = get_type(a);
+
+  // Boxed integers never hold a 32-bit value.
+  if (a_type != get_type(b) && IS_INTEGER(a) && IS_INTEGER(b)) return MAKE_INTEGER(0);
+
   ASSERT_FMT(a_type == get_type(b), "Cannot compare values of different types: %s and %s", type_of(a), type_of(b));
 
   switch (a_type) {
@@ -129,9 +236,11 @@ Value compare_eq(Value a, Value b) {
 
       return MAKE_INTEGER(strcmp(a_ptr->as_string, b_ptr->as_string) == 0);
     }
-    case TYPE_FUNCTION: case TYPE_FUNCENV: case TYPE_MUTABLE: {
+    case TYPE_FUNCTION: case TYPE_MUTABLE: {
       return MAKE_INTEGER(a == b);
     }
+    case TYPE_INT64:
+      return MAKE_INTEGER(GET_INT64(a) == GET_INT64(b));
     case TYPE_LIST: {
       HeapValue* a_ptr = GET_PTR(a);
       HeapValue* b_ptr = GET_PTR(b);
@@ -150,6 +259,55 @@ Value compare_eq(Value a, Value b) {
   }
 }
 
+// Floats only combine with floats, and integers with integers of either
+// size. 64-bit results that overflow are errors.
+Value generic_arithmetic(Deserialized *module, Opcode opcode, Value x, Value y) {
+  if (IS_FLOAT(x) && IS_FLOAT(y)) {
+    double a = GET_FLOAT(x), b = GET_FLOAT(y);
+    double result = opcode == OP_Add ? a + b : opcode == OP_Sub ? a - b : a * b;
+    return MAKE_FLOAT(result);
+  }
+
+  ASSERT_FMT(IS_INTEGER(x) && IS_INTEGER(y), "Expected numbers, got %s and %s", type_of(x), type_of(y));
+
+  int64_t a = GET_INT64(x), b = GET_INT64(y), result;
+  bool overflows;
+
+  switch (opcode) {
+    case OP_Add: overflows = __builtin_add_overflow(a, b, &result); break;
+    case OP_Sub: overflows = __builtin_sub_overflow(a, b, &result); break;
+    default: overflows = __builtin_mul_overflow(a, b, &result); break;
+  }
+
+  ASSERT(!overflows, "Integer overflow");
+  return MAKE_INT64(module->stack, result);
+}
+
+// Comparisons of integers that do not all fit in 32 bits.
+static bool compare_int64(Comparison comparison, int64_t x, int64_t y) {
+  switch (comparison) {
+    case LessThan: return x < y;
+    case GreaterThan: return x > y;
+    case EqualTo: return x == y;
+    case NotEqualTo: return x != y;
+    case LessThanOrEqualTo: return x <= y;
+    case GreaterThanOrEqualTo: return x >= y;
+    case And: return (x & y) != 0;
+    case Or: return (x | y) != 0;
+    default: THROW_FMT("Cannot compare boxed integers with %d", comparison);
+  }
+}
+
+// The Comparison of the kinds integer jumps implement.
+static Comparison kind_comparison(ComparisonKind kind) {
+  switch (kind) {
+    case KindEqualTo: return EqualTo;
+    case KindAnd: return And;
+    case KindOr: return Or;
+    default: THROW_FMT("Unsupported integer comparison %d", kind);
+  }
+}
+
 Value compare_and(Value a, Value b) {
   ASSERT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers");
   return MAKE_INTEGER(GET_INT(a) && GET_INT(b));
@@ -161,32 +319,178 @@ Value compare_or(Value a, Value b) {
 }
 
 Value compare_gt(Value a, Value b) {
-  ASSERT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers");
-  return MAKE_INTEGER(GET_INT(a) > GET_INT(b));
+  if (IS_INT(a) && IS_INT(b)) return MAKE_INTEGER((int32_t) GET_INT(a) > (int32_t) GET_INT(b));
+  if (IS_FLOAT(a) && IS_FLOAT(b)) return MAKE_INTEGER(GET_FLOAT(a) > GET_FLOAT(b));
+
+  ASSERT(IS_INTEGER(a) && IS_INTEGER(b), "Expected integers");
+  return MAKE_INTEGER(compare_int64(GreaterThan, GET_INT64(a), GET_INT64(b)));
 }
 
-ComparisonFun comparison_table[] = { NULL, compare_gt, compare_eq, NULL, NULL, compare_and, compare_or };
+ComparisonFun comparison_table[] = {
+  [KindGreaterThan] = compare_gt, [KindEqualTo] = compare_eq,
+  [KindAnd] = compare_and, [KindOr] = compare_or };
 
-void op_call(Deserialized *module, Value callee, int32_t argc) {
-  ASSERT_FMT(module->call_stack.frame_pointer < MAX_FRAMES, "Call stack overflow, reached %d", module->call_stack.frame_pointer);
+#define COMPARISON_COUNT (int32_t) (sizeof(comparison_table) / sizeof(ComparisonFun))
+#define HAS_COMPARISON(c) ((c) >= 0 && (c) < COMPARISON_COUNT && comparison_table[c] != NULL)
 
-  int16_t ipc = (int16_t) (callee & MASK_PAYLOAD_INT);
-  int16_t local_space = (int16_t) ((callee >> 16) & MASK_PAYLOAD_INT);
-  int16_t old_sp = module->stack->stack_pointer - argc;
+bool has_comparison(int32_t kind) {
+  return HAS_COMPARISON(kind);
+}
 
-  module->stack->stack_pointer += local_space - argc;
+// Enters the function: its frame is pushed, and the pc moved to its entry.
+void push_frame(Deserialized *module, Value callee, int32_t argc) {
+  FunctionDescriptor* function = get_function(module, callee);
+  push_frame_at(module, function->entry, function->local_space, argc);
+}
 
-  int32_t new_pc = module->pc + 4;
+void push_frame_at(Deserialized *module, int32_t ipc, int32_t local_space, int32_t argc) {
+  int32_t old_sp = module->stack->stack_pointer - argc;
 
-  stack_push(module->stack, MAKE_FUNCENV(new_pc, old_sp, module->base_pointer));
+  // Single capacity check for the whole frame: the interpreter pushes
+  // without checking inside the function body.
+  stack_reserve(module->stack, local_space - argc + module->stack_depths[ipc]);
 
-  module->base_pointer = module->stack->stack_pointer - 1;
-  module->call_stack.frame_pointer++;
+  module->stack->stack_pointer += local_space - argc;
+
+  // Calls save the state past the call instruction, where the callee
+  // returns.
+  int32_t new_pc = module->pc;
+
+  push_call_frame(&module->call_stack, (Frame) { new_pc, old_sp, module->base_pointer });
+  module->base_pointer = module->stack->stack_pointer;
 
   module->pc = ipc;
 }
 
+// Runs a call made from C until it returns, compiled or interpreted, with its
+// result pushed. Its frame returns to the Exit instruction, which leaves the
+// interpreter loop running it, and the pc of the caller is kept.
+void run_call(Deserialized *module, int32_t ipc, int32_t local_space, int32_t argc, JitFunction compiled) {
+  int32_t pc = module->pc;
+
+  module->pc = module->exit_pc;
+  push_frame_at(module, ipc, local_space, argc);
+
+  if (compiled != NULL) compiled(module);
+  else run_interpreter(module, ipc);
+
+  module->pc = pc;
+}
+
+// Calls the pure function at `ipc`, only entering its frame when it was not
+// called with the same arguments recently. The call is complete when it
+// returns true, with its result pushed. Misses past MEMO_MAX_DEPTH return
+// false, and are left to the caller as ordinary calls.
+bool memoized_call(Deserialized *module, MemoTable *memo, int32_t ipc, int32_t local_space, int32_t argc) {
+  Stack* stack = module->stack;
+  Value* args = &stack->values[stack->stack_pointer - argc];
+  uint64_t hash = memo_hash(args, argc);
+  Value result;
+
+  if (memo_lookup(memo, args, argc, hash, &result)) {
+    stack->stack_pointer -= argc;
+    stack_push(stack, result);
+    return true;
+  }
+
+  if (module->call_stack.frame_pointer >= MEMO_MAX_DEPTH) return false;
+
+  // Arguments are locals of the callee, which may overwrite them.
+  Value saved[argc + 1];
+  memcpy(saved, args, argc * sizeof(Value));
+
+  run_call(module, ipc, local_space, argc, jit_lookup(module, ipc));
+  memo_store(memo, saved, argc, hash, stack->values[stack->stack_pointer - 1]);
+  return true;
+}
+
+void op_call(Deserialized *module, Value callee, int32_t argc) {
+  FunctionDescriptor* function = get_function(module, callee);
+  MemoTable* memo = memo_table(module->memo, function->entry);
+
+  if (memo != NULL && memoized_call(module, memo, function->entry, function->local_space, argc)) {
+    return;
+  }
+
+  // Interpreted callees run in the current loop.
+  JitFunction compiled = jit_lookup(module, function->entry);
+  if (compiled != NULL) run_call(module, function->entry, function->local_space, argc, compiled);
+  else push_frame_at(module, function->entry, function->local_space, argc);
+}
+
+// Calls through the inline cache of a call site. Hits skip the type test of
+// the callee, and the decoding of its entry point and frame size.
+static inline void cached_call(Deserialized *module, CallCache *cache, Value callee, int32_t argc) {
+  if (callee != cache->callee) {
+    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+    if (!IS_FUN(callee)) {
+      op_native_call(module, callee, argc);
+      return;
+    }
+
+    if (cache->callee != EMPTY_CALL_CACHE) cache->megamorphic = true;
+
+    cache->callee = callee;
+    cache->ipc = get_function(module, callee)->entry;
+    cache->local_space = get_function(module, callee)->local_space;
+    cache->memo = memo_table(module->memo, cache->ipc);
+  }
+
+  if (cache->memo != NULL && !cache->memo->disabled
+      && memoized_call(module, cache->memo, cache->ipc, cache->local_space, argc)) {
+    return;
+  }
+
+  JitFunction compiled = jit_lookup(module, cache->ipc);
+  if (compiled != NULL) run_call(module, cache->ipc, cache->local_space, argc, compiled);
+  else push_frame_at(module, cache->ipc, cache->local_space, argc);
+}
+
+CallCache* new_call_caches(int32_t count) {
+  CallCache* caches = malloc((count + 1) * sizeof(CallCache));
+
+  for (int32_t i = 0; i < count; i++) {
+    caches[i] = (CallCache) { EMPTY_CALL_CACHE, 0, 0, NULL, false };
+  }
+
+  return caches;
+}
+
+void print_call_cache_stats(Deserialized *module) {
+  int32_t monomorphic = 0, megamorphic = 0;
+
+  for (int32_t i = 0; i < module->call_cache_count; i++) {
+    CallCache cache = module->call_caches[i];
+
+    if (cache.megamorphic) megamorphic++;
+    else if (cache.callee != EMPTY_CALL_CACHE) monomorphic++;
+  }
+
+  printf("Call sites: %d monomorphic, %d megamorphic, %d never run\n", monomorphic,
+         megamorphic, module->call_cache_count - monomorphic - megamorphic);
+}
+
+void insert_environment(Deserialized *module, Closure *closure, int32_t argc) {
+  Stack* stack = module->stack;
+  stack_reserve(stack, 1);
+
+  Value* args = &stack->values[stack->stack_pointer - argc];
+  memmove(args + 1, args, argc * sizeof(Value));
+  args[0] = closure->values[0];
+  stack->stack_pointer++;
+}
+
+// Closures are pointers like natives, and are called through the same path,
+// to completion.
 void op_native_call(Deserialized *module, Value callee, int32_t argc) {
+  Closure* closure = get_closure(callee);
+  if (closure != NULL) {
+    insert_environment(module, closure, argc);
+    complete_call(module, closure->entry, closure->local_space, argc + 1);
+    return;
+  }
+
   char* fun = GET_NATIVE(callee);
 
   Value libIdx = stack_pop(module->stack);
@@ -220,27 +524,37 @@ void op_native_call(Deserialized *module, Value callee, int32_t argc) {
 
     stack_push(module->stack, ret);
   }
-
-  module->pc += 4;
 }
 
-typedef void (*InterpreterFunc)(Deserialized*, Value, int32_t);
+// Calls the function in place of the current frame: the arguments are moved
+// down to the caller's stack pointer, and the new frame keeps the current
+// one's return.
+void op_tail_call(Deserialized *module, Value callee, int32_t argc) {
+  Value* values = module->stack->values;
 
-InterpreterFunc interpreter_table[] = { op_native_call, op_call };
+  int32_t ipc = get_function(module, callee)->entry;
+  int32_t local_space = get_function(module, callee)->local_space;
 
-Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32_t current_callstack) {
-  Constants constants = module->constants;
-  int32_t* bytecode = module->instrs;
+  CallStack* call_stack = &module->call_stack;
+  Frame fr = call_stack->frames[call_stack->frame_pointer - 1];
+
+  stack_reserve(module->stack, fr.stack_pointer + local_space + module->stack_depths[ipc] - module->stack->stack_pointer);
+  values = module->stack->values;
+
+  memmove(&values[fr.stack_pointer], &values[module->stack->stack_pointer - argc], argc * sizeof(Value));
+  module->stack->stack_pointer = fr.stack_pointer + local_space;
+
+  module->base_pointer = module->stack->stack_pointer;
   module->pc = ipc;
+}
 
-  #define op bytecode[module->pc]
-  #define i1 bytecode[module->pc + 1]
-  #define i2 bytecode[module->pc + 2]
-  #define i3 bytecode[module->pc + 3]
+InterpreterFunc interpreter_table[] = { op_native_call, op_call };
+InterpreterFunc tail_interpreter_table[] = { op_native_call, op_tail_call };
 
+Value run_interpreter(Deserialized *module, int32_t ipc) {
   #define UNKNOWN &&case_unknown
 
-  void* jmp_table[] = {
+  static void* jmp_table[OPCODE_COUNT] = {
     &&case_load_local, &&case_store_local, &&case_load_constant,
     &&case_load_global, &&case_store_global, &&case_return,
     &&case_compare, &&case_and, &&case_or, &&case_load_native,
@@ -254,166 +568,291 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     &&case_jump_else_rel_cmp_constant,
     &&case_ijump_else_rel_cmp_constant, &&case_call_global,
     &&case_call_local, &&case_make_and_store_lambda, &&case_mul,
-    &&case_mul_const, &&case_return_unit };
+    &&case_mul_const, &&case_return_unit, &&case_load_local2,
+    &&case_add_locals, &&case_sub_locals, &&case_mul_locals,
+    &&case_load_local_add_const, &&case_load_local_sub_const,
+    &&case_add_const_local, &&case_sub_const_local,
+    &&case_load_local_list_get, &&case_call_native, &&case_tail_call,
+    &&case_tail_call_global, &&case_tail_call_local, &&case_switch,
+    &&case_switch_sparse, &&case_switch_case, &&case_constructor_tag,
+    &&case_count, &&case_exit, &&case_rmove,
+    &&case_rload_constant, &&case_radd, &&case_rsub, &&case_rmul,
+    &&case_radd_const, &&case_rsub_const, &&case_rmul_const,
+    &&case_rcompare, &&case_rjump_else_rel, &&case_rjump_else_rel_cmp,
+    &&case_rijump_else_rel_cmp, &&case_rjump_else_rel_cmp_constant,
+    &&case_rijump_else_rel_cmp_constant, &&case_rreturn };
+
+  if (module == NULL) {
+    dispatch_table = jmp_table;
+    return 0;
+  }
 
-  goto *jmp_table[op];
+  Constants constants = module->constants;
+  int32_t* bytecode = module->code;
+
+  stack_reserve(module->stack, module->stack_depths[ipc]);
+
+  // The interpreter state is kept in locals so that the compiler can hold it
+  // in registers. It is only written back to the module around calls and
+  // returns, where other functions need to observe it.
+  int32_t* pc = bytecode + ipc;
+  Value* values = module->stack->values;
+  Value* sp = values + module->stack->stack_pointer;
+  Value* bp = values + module->base_pointer;
+
+  // Operands of the handlers that branch through a table of their own. As far
+  // as the compiler knows, the labels of those tables are reachable from any
+  // dispatch, so the operands are declared here, where they are always
+  // defined.
+  Value a = 0, b = 0;
+
+  #define SAVE_STATE()                                  \
+    do {                                                \
+      module->pc = pc - bytecode;                       \
+      module->stack->stack_pointer = sp - values;       \
+      module->base_pointer = bp - values;               \
+    } while (0)
+
+  #define LOAD_STATE()                                  \
+    do {                                                \
+      values = module->stack->values;                   \
+      pc = bytecode + module->pc;                       \
+      sp = values + module->stack->stack_pointer;       \
+      bp = values + module->base_pointer;               \
+    } while (0)
+
+  // Pushes are unchecked: every function entry reserves the maximum stack
+  // depth of the function (see compute_stack_depths), so the stack can only
+  // move at call boundaries, where the state is reloaded.
+  #define push(v) (*sp++ = (v))
+
+  #define pop() (*--sp)
+  #define pop_n(n) (sp -= (n))
+
+  // Operands follow the handler offset. The constant of an instruction comes
+  // after its n operands.
+  #define i1 pc[1]
+  #define i2 pc[2]
+  #define i3 pc[3]
+  #define i4 pc[4]
+  #define cst(n) read_constant(pc + 1 + (n))
+
+  DISPATCH();
 
   case_load_local: {
-    int32_t locals = module->base_pointer;
-
-    Value value = module->stack->values[locals + i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = bp[i1];
+    push(value);
+    INCREASE_IP(OP_LoadLocal);
+    DISPATCH();
   }
 
   case_store_local: {
-    int32_t locals = module->base_pointer;
-    module->stack->values[locals + i1] = stack_pop(module->stack);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    bp[i1] = pop();
+    INCREASE_IP(OP_StoreLocal);
+    DISPATCH();
   }
 
   case_load_constant: {
-    Value value = constants.constants[i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = cst(0);
+    push(value);
+    INCREASE_IP(OP_LoadConstant);
+    DISPATCH();
   }
 
   case_load_global: {
-    Value value = module->stack->values[i1];
-    stack_push(module->stack, value);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = values[i1];
+    push(value);
+    INCREASE_IP(OP_LoadGlobal);
+    DISPATCH();
   }
 
   case_store_global: {
-    Value v = stack_pop(module->stack);
-    module->stack->values[i1] = v;
+    Value v = pop();
+    values[i1] = v;
 
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    INCREASE_IP(OP_StoreGlobal);
+    DISPATCH();
   }
 
   case_return: {
     Frame fr = pop_frame(module);
-    Value ret = stack_pop(module->stack);
-
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
-    stack_push(module->stack, ret);
+    Value ret = pop();
 
-    module->pc = fr.instruction_pointer;
+    sp = values + fr.stack_pointer;
+    bp = values + fr.base_ptr;
+    push(ret);
 
-    if (does_return && current_callstack == module->call_stack.frame_pointer) 
-      return ret;
+    pc = bytecode + fr.instruction_pointer;
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_compare: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
+
+    if (IS_INT(a) && IS_INT(b) && HAS_COMPARISON(i1)) {
+      QUICKEN(case_compare_int);
+    } else if (IS_FLOAT(a) && IS_FLOAT(b) && (i1 == KindEqualTo || i1 == KindGreaterThan)) {
+      QUICKEN(case_compare_float);
+    }
+
+    push(comparison_table[i1](b, a));
+    INCREASE_IP(OP_Compare);
+    DISPATCH();
+  }
+
+  case_compare_int: {
+    static void* int_comparisons[] = {
+      [KindGreaterThan] = &&cmp_int_gt, [KindEqualTo] = &&cmp_int_eq,
+      [KindAnd] = &&cmp_int_and, [KindOr] = &&cmp_int_or };
+
+    a = sp[-1];
+    b = sp[-2];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      QUICKEN(case_compare);
+      goto case_compare;
+    }
+
+    sp--;
+    goto *int_comparisons[i1];
+
+    cmp_int_gt: { sp[-1] = MAKE_INTEGER((int32_t) GET_INT(b) > (int32_t) GET_INT(a)); goto cmp_int_next; }
+    cmp_int_eq: { sp[-1] = MAKE_INTEGER(a == b); goto cmp_int_next; }
+    cmp_int_and: { sp[-1] = MAKE_INTEGER(GET_INT(b) && GET_INT(a)); goto cmp_int_next; }
+    cmp_int_or: { sp[-1] = MAKE_INTEGER(GET_INT(b) || GET_INT(a)); goto cmp_int_next; }
+
+    cmp_int_next: {
+      INCREASE_IP(OP_Compare);
+      DISPATCH();
+    }
+  }
+
+  case_compare_float: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_FLOAT(a) || !IS_FLOAT(b)) {
+      QUICKEN(case_compare);
+      goto case_compare;
+    }
 
-    stack_push(module->stack, comparison_table[i1](b, a));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    sp--;
+    sp[-1] = MAKE_INTEGER(i1 == KindEqualTo ? GET_FLOAT(b) == GET_FLOAT(a) : GET_FLOAT(b) > GET_FLOAT(a));
+    INCREASE_IP(OP_Compare);
+    DISPATCH();
   }
 
   case_and: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
 
     ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
 
-    stack_push(module->stack, MAKE_INTEGER(a && b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_INTEGER(a && b));
+    INCREASE_IP(OP_And);
+    DISPATCH();
   }
 
   case_or: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
 
     ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
 
-    stack_push(module->stack, MAKE_INTEGER(a || b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_INTEGER(a || b));
+    INCREASE_IP(OP_Or);
+    DISPATCH();
   }
 
   case_load_native: {
     Value name = constants.constants[i1];
-    ASSERT(get_type(name) == TYPE_STRING, "Invalid native function name type");
-    stack_push(module->stack, MAKE_INTEGER(i2));
-    stack_push(module->stack, MAKE_INTEGER(i3));
-    stack_push(module->stack, name);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    ASSERT_VERIFIED(get_type(name) == TYPE_STRING, "Invalid native function name type");
+    push(MAKE_INTEGER(i2));
+    push(MAKE_INTEGER(i3));
+    push(name);
+    INCREASE_IP(OP_LoadNative);
+    DISPATCH();
   }
 
   case_make_list: {
-    Value* values = GC_malloc(sizeof(Value) * i1);
-    memcpy(values, stack_pop_n(module->stack, i1),
-            i1 * sizeof(Value));
-    stack_push(module->stack, MAKE_LIST(module->stack, values, i1));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value* values = pop_n(i1);
+    Value list;
+
+    if (i1 == 0) {
+      list = empty_list;
+    } else if (IS_CONSTRUCTOR(values, i1)) {
+      list = MAKE_CONSTRUCTOR(module->stack, values, i1);
+    } else if (IS_CLOSURE(values, i1)) {
+      FunctionDescriptor* function = get_function(module, values[1]);
+      list = MAKE_CLOSURE(module->stack, values, function->entry, function->local_space);
+    } else {
+      Value* items = GC_malloc(sizeof(Value) * i1);
+      memcpy(items, values, i1 * sizeof(Value));
+      list = MAKE_LIST(module->stack, items, i1);
+    }
+
+    push(list);
+    INCREASE_IP(OP_MakeList);
+    DISPATCH();
   }
 
   case_list_get: {
-    Value list = stack_pop(module->stack);
+    Value list = pop();
     uint32_t idx = GET_INT(i1);
-    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", module->pc / 4);
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", (int32_t) (pc - bytecode));
     HeapValue* l = GET_PTR(list);
     ASSERT(idx < l->length, "Index out of bounds");
-    stack_push(module->stack, l->as_ptr[idx]);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(l->as_ptr[idx]);
+    INCREASE_IP(OP_ListGet);
+    DISPATCH();
   }
 
   case_call: {
-    Value callee = stack_pop(module->stack);
+    Value callee = pop();
+    int32_t argc = i1;
 
     ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
-    
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i1);
 
-    goto *jmp_table[op];
+    INCREASE_IP(OP_Call);
+    SAVE_STATE();
+    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, argc);
+    LOAD_STATE();
+
+    DISPATCH();
   }
 
   case_jump_else_rel: {
-    Value value = stack_pop(module->stack);
+    Value value = pop();
     ASSERT(get_type(value) == TYPE_INTEGER, "Invalid value type")
     if (GET_INT(value) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP(OP_JumpElseRel);
     }
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_type_of: {
-    Value value = stack_pop(module->stack);
-    stack_push(module->stack, MAKE_STRING(module->stack, type_of(value)));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    Value value = pop();
+    push(type_names[get_type(value)]);
+    INCREASE_IP(OP_TypeOf);
+    DISPATCH();
   }
 
   case_make_lambda: {
-    int32_t new_pc = module->pc + 4;
-    Value lambda = MAKE_FUNCTION(new_pc, i2);
+    Value lambda = MAKE_FUNCTION(i3);
 
-    stack_push(module->stack, lambda);
-    INCREASE_IP_BY(module, i1 + 1);
+    push(lambda);
+    INCREASE_IP_BY(i1 + 1);
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_get_index: {
-    Value index = stack_pop(module->stack);
-    Value list = stack_pop(module->stack);
+    Value index = pop();
+    Value list = pop();
     ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
     ASSERT(get_type(index) == TYPE_INTEGER, "Invalid index type");
 
@@ -421,24 +860,24 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     uint32_t idx = GET_INT(index);
 
     ASSERT(idx < l->length, "Index out of bounds");
-    stack_push(module->stack, l->as_ptr[idx]);
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(l->as_ptr[idx]);
+    INCREASE_IP(OP_GetIndex);
+    DISPATCH();
   }
 
   case_special: {
-    stack_push(module->stack, MAKE_SPECIAL());
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_SPECIAL());
+    INCREASE_IP(OP_Special);
+    DISPATCH();
   }
 
   case_jump_rel: {
-    INCREASE_IP_BY(module, i1);
-    goto *jmp_table[op];
+    INCREASE_IP_BY(i1);
+    DISPATCH();
   }
 
   case_slice: {
-    Value list = stack_pop(module->stack);
+    Value list = pop();
     ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
     HeapValue* l = GET_PTR(list);
     HeapValue* new_list = allocate(module->stack, TYPE_LIST, l->length - i1);
@@ -446,18 +885,18 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     new_list->as_ptr = GC_malloc(sizeof(Value) * new_list->length);
 
     memcpy(new_list->as_ptr, &l->as_ptr[i1], (l->length - i1) * sizeof(Value));
-    stack_push(module->stack, MAKE_PTR(new_list));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_PTR(new_list));
+    INCREASE_IP(OP_Slice);
+    DISPATCH();
   }
 
   case_list_length: {
-    Value list = stack_pop(module->stack);
-    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", module->pc / 4);
+    Value list = pop();
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", (int32_t) (pc - bytecode));
     HeapValue* l = GET_PTR(list);
-    stack_push(module->stack, MAKE_INTEGER(l->length));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_INTEGER(l->length));
+    INCREASE_IP(OP_ListLength);
+    DISPATCH();
   }
 
   case_halt: {
@@ -466,118 +905,258 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
   }
 
   case_update: {
-    Value var = stack_pop(module->stack);
+    Value var = pop();
     ASSERT(get_type(var) == TYPE_MUTABLE, "Invalid mutable type");
 
     HeapValue* l = GET_PTR(var);
 
-    Value value = stack_pop(module->stack);
+    Value value = pop();
     memcpy(l->as_ptr, &value, sizeof(Value));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    INCREASE_IP(OP_Update);
+    DISPATCH();
   }
 
   case_make_mutable: {
-    Value value = stack_pop(module->stack);
+    Value value = pop();
     Value* v = GC_malloc(sizeof(Value));
     memcpy(v, &value, sizeof(Value));
     
     HeapValue* l = allocate(module->stack, TYPE_MUTABLE, 1);
     l->as_ptr = v;
 
-    stack_push(module->stack, MAKE_PTR(l));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(MAKE_PTR(l));
+    INCREASE_IP(OP_MakeMutable);
+    DISPATCH();
   }
 
   case_unmut: {
-    Value value = stack_pop(module->stack);
+    Value value = pop();
     ASSERT(get_type(value) == TYPE_MUTABLE, "Invalid mutable type");
-    stack_push(module->stack, GET_MUTABLE(value));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(GET_MUTABLE(value));
+    INCREASE_IP(OP_UnMut);
+    DISPATCH();
   }
 
   case_add: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+    if (IS_INT(a) && IS_INT(b)) {
+      QUICKEN(case_add_int);
+    } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+      QUICKEN(case_add_float);
+    }
+
+    push(generic_arithmetic(module, OP_Add, b, a));
+    INCREASE_IP(OP_Add);
+    DISPATCH();
+  }
+
+  case_add_int: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      QUICKEN(case_add);
+      goto case_add;
+    }
+
+    sp[-2] = arithmetic(module, OP_Add, b, a);
+    sp--;
+    INCREASE_IP(OP_Add);
+    DISPATCH();
+  }
+
+  case_add_float: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_FLOAT(a) || !IS_FLOAT(b)) {
+      QUICKEN(case_add);
+      goto case_add;
+    }
 
-    stack_push(module->stack, MAKE_INTEGER(a + b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    double result = GET_FLOAT(b) + GET_FLOAT(a);
+    sp[-2] = MAKE_FLOAT(result);
+    sp--;
+    INCREASE_IP(OP_Add);
+    DISPATCH();
   }
 
   case_sub: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+    if (IS_INT(a) && IS_INT(b)) {
+      QUICKEN(case_sub_int);
+    } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+      QUICKEN(case_sub_float);
+    }
 
-    stack_push(module->stack, MAKE_INTEGER(b - a));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(generic_arithmetic(module, OP_Sub, b, a));
+    INCREASE_IP(OP_Sub);
+    DISPATCH();
+  }
+
+  case_sub_int: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      QUICKEN(case_sub);
+      goto case_sub;
+    }
+
+    sp[-2] = arithmetic(module, OP_Sub, b, a);
+    sp--;
+    INCREASE_IP(OP_Sub);
+    DISPATCH();
+  }
+
+  case_sub_float: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_FLOAT(a) || !IS_FLOAT(b)) {
+      QUICKEN(case_sub);
+      goto case_sub;
+    }
+
+    double result = GET_FLOAT(b) - GET_FLOAT(a);
+    sp[-2] = MAKE_FLOAT(result);
+    sp--;
+    INCREASE_IP(OP_Sub);
+    DISPATCH();
   }
 
   case_return_const: {
-    Frame fr = pop_frame(module);
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
+    Value ret = cst(0);
 
-    stack_push(module->stack, constants.constants[i1]);
+    Frame fr = pop_frame(module);
+    sp = values + fr.stack_pointer;
+    bp = values + fr.base_ptr;
 
-    module->pc = fr.instruction_pointer;
+    push(ret);
 
-    if (does_return) return constants.constants[i1];
+    pc = bytecode + fr.instruction_pointer;
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_add_const: {
-    Value a = stack_pop(module->stack);
-    Value b = constants.constants[i1];
+    Value a = pop();
+    Value b = cst(0);
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+    ASSERT_VERIFIED(get_type(b) == TYPE_INTEGER, "Expected integer constant");
 
-    stack_push(module->stack, MAKE_INTEGER(a + b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    if (IS_INT(a)) QUICKEN(case_add_const_int);
+    push(generic_arithmetic(module, OP_Add, a, b));
+    INCREASE_IP(OP_AddConst);
+    DISPATCH();
+  }
+
+  case_add_const_int: {
+    Value a = sp[-1];
+    Value b = cst(0);
+
+    if (!IS_INT(a)) {
+      QUICKEN(case_add_const);
+      goto case_add_const;
+    }
+
+    sp[-1] = arithmetic(module, OP_Add, a, b);
+    INCREASE_IP(OP_AddConst);
+    DISPATCH();
   }
 
   case_sub_const: {
-    Value a = stack_pop(module->stack);
-    Value b = constants.constants[i1];
+    Value a = pop();
+    Value b = cst(0);
+
+    ASSERT_VERIFIED(get_type(b) == TYPE_INTEGER, "Expected integer constant");
+    if (IS_INT(a)) QUICKEN(case_sub_const_int);
+    push(generic_arithmetic(module, OP_Sub, a, b));
+    INCREASE_IP(OP_SubConst);
+    DISPATCH();
+  }
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
-    stack_push(module->stack, MAKE_INTEGER(a - b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+  case_sub_const_int: {
+    Value a = sp[-1];
+    Value b = cst(0);
+
+    if (!IS_INT(a)) {
+      QUICKEN(case_sub_const);
+      goto case_sub_const;
+    }
+
+    sp[-1] = arithmetic(module, OP_Sub, a, b);
+    INCREASE_IP(OP_SubConst);
+    DISPATCH();
   }
 
   case_jump_else_rel_cmp: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
+
+    if (IS_INT(a) && IS_INT(b) && HAS_COMPARISON(i2)) {
+      QUICKEN(case_jump_else_rel_cmp_int);
+    }
 
     Value cmp = comparison_table[i2](a, b);
-    ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+    ASSERT_VERIFIED(get_type(cmp) == TYPE_INTEGER, "Expected integer");
 
     if (GET_INT(cmp) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP(OP_JumpElseRelCmp);
     }
 
-    goto *jmp_table[op];
+    DISPATCH();
+  }
+
+  case_jump_else_rel_cmp_int: {
+    static void* int_comparisons[] = {
+      [KindGreaterThan] = &&jcmp_int_gt, [KindEqualTo] = &&jcmp_int_eq,
+      [KindAnd] = &&jcmp_int_and, [KindOr] = &&jcmp_int_or };
+
+    a = sp[-1];
+    b = sp[-2];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      QUICKEN(case_jump_else_rel_cmp);
+      goto case_jump_else_rel_cmp;
+    }
+
+    sp -= 2;
+
+    uint32_t res;
+
+    goto *int_comparisons[i2];
+
+    jcmp_int_gt: { res = (int32_t) GET_INT(a) > (int32_t) GET_INT(b); goto jcmp_int_next; }
+    jcmp_int_eq: { res = a == b; goto jcmp_int_next; }
+    jcmp_int_and: { res = GET_INT(a) && GET_INT(b); goto jcmp_int_next; }
+    jcmp_int_or: { res = GET_INT(a) || GET_INT(b); goto jcmp_int_next; }
+
+    jcmp_int_next: {
+      INCREASE_IP_BY(res == 0 ? i1 : code_words(OP_JumpElseRelCmp));
+      DISPATCH();
+    }
   }
 
   case_ijump_else_rel_cmp: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    a = pop();
+    b = pop();
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      ASSERT(IS_INTEGER(a) && IS_INTEGER(b), "Expected integers");
+      bool res = compare_int64(kind_comparison(i1), GET_INT64(a), GET_INT64(b));
+      INCREASE_IP_BY(!res ? i2 : code_words(OP_IJumpElseRelCmp));
+      DISPATCH();
+    }
 
-    void* icomparison_table[] = {
-      UNKNOWN, UNKNOWN, &&icmp_eq, UNKNOWN,
-      UNKNOWN, &&icmp_and, &&icmp_or };
+    static void* icomparison_table[] = {
+      [KindEqualTo] = &&icmp_eq, [KindAnd] = &&icmp_and, [KindOr] = &&icmp_or };
 
     uint32_t res;
 
@@ -588,36 +1167,58 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
     icmp_or: { res = GET_INT(a) | GET_INT(b); goto next; }
 
     next: {
-      INCREASE_IP_BY(module, (uint32_t) res == 0 ? i2 : 1);
-      goto *jmp_table[op];
+      INCREASE_IP_BY((uint32_t) res == 0 ? i2 : code_words(OP_IJumpElseRelCmp));
+      DISPATCH();
     }
   }
 
   case_jump_else_rel_cmp_constant: {
-    Value a = stack_pop(module->stack);
-    Value b = constants.constants[i3];
-
-    ASSERT(get_type(a) == get_type(b), "Expected integers");
+    Value a = pop();
+    Value b = cst(1);
 
     Value cmp = compare_eq(a, b);
-    ASSERT(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+    ASSERT_VERIFIED(get_type(cmp) == TYPE_INTEGER, "Expected integer");
 
     if (GET_INT(cmp) == 0) {
-      INCREASE_IP_BY(module, i1);
+      INCREASE_IP_BY(i1);
     } else {
-      INCREASE_IP(module);
+      INCREASE_IP(OP_JumpElseRelCmpConst);
     }
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_ijump_else_rel_cmp_constant: {
-    Value a = stack_pop(module->stack);
-    Value b = constants.constants[i3];
+    Value a = sp[-1];
+    Value b = cst(2);
+
+    ASSERT_VERIFIED(get_type(b) == TYPE_INTEGER, "Expected integer constant");
+
+    if (IS_INT64(a)) {
+      sp--;
+      bool res = compare_int64(i2, GET_INT64(a), GET_INT64(b));
+      INCREASE_IP_BY(!res ? i1 : code_words(OP_IJumpElseRelCmpConst));
+      DISPATCH();
+    }
+
+    ASSERT(get_type(a) == TYPE_INTEGER, "Expected integers");
+
+    QUICKEN(case_ijump_else_rel_cmp_constant_int);
+    goto icmp_cst;
+  }
+
+  case_ijump_else_rel_cmp_constant_int: {
+    if (!IS_INT(sp[-1])) {
+      QUICKEN(case_ijump_else_rel_cmp_constant);
+      goto case_ijump_else_rel_cmp_constant;
+    }
+  }
 
-    ASSERT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers");
+  icmp_cst: {
+    a = pop();
+    b = cst(2);
 
-    void* icomparison_table[] = {
+    static void* icomparison_table[] = {
       &&icmp_cst_lt, &&icmp_cst_gt, &&icmp_cst_eq, &&icmp_cst_neq,
       &&icmp_cst_lte, &&icmp_cst_gte, &&icmp_cst_and, &&icmp_cst_or };
 
@@ -625,96 +1226,740 @@ Value run_interpreter(Deserialized *module, int32_t ipc, bool does_return, int32
 
     goto *icomparison_table[i2];
 
-    icmp_cst_lt: { res = GET_INT(a) < GET_INT(b); goto next_cst; }
-    icmp_cst_gt: { res = GET_INT(a) > GET_INT(b); goto next_cst; }
+    icmp_cst_lt: { res = (int32_t) GET_INT(a) < (int32_t) GET_INT(b); goto next_cst; }
+    icmp_cst_gt: { res = (int32_t) GET_INT(a) > (int32_t) GET_INT(b); goto next_cst; }
     icmp_cst_eq: { res = GET_INT(a) == GET_INT(b); goto next_cst; }
     icmp_cst_neq: { res = GET_INT(a) != GET_INT(b); goto next_cst; }
-    icmp_cst_gte: { res = GET_INT(a) >= GET_INT(b); goto next_cst; }
-    icmp_cst_lte: { res = GET_INT(a) <= GET_INT(b); goto next_cst; }
+    icmp_cst_gte: { res = (int32_t) GET_INT(a) >= (int32_t) GET_INT(b); goto next_cst; }
+    icmp_cst_lte: { res = (int32_t) GET_INT(a) <= (int32_t) GET_INT(b); goto next_cst; }
     icmp_cst_and: { res = GET_INT(a) & GET_INT(b); goto next_cst; }
     icmp_cst_or: { res = GET_INT(a) | GET_INT(b); goto next_cst; }
 
     next_cst: {
-      INCREASE_IP_BY(module, (uint32_t) res == 0 ? i1 : 1);
-      goto *jmp_table[op];
+      INCREASE_IP_BY((uint32_t) res == 0 ? i1 : code_words(OP_IJumpElseRelCmpConst));
+      DISPATCH();
     }
   }
 
   case_call_global: {
-    Value callee = module->stack->values[i1];
-
-    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+    Value callee = values[i1];
+    int32_t argc = i2;
+    CallCache* cache = &module->call_caches[i3];
 
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i2);
+    INCREASE_IP(OP_CallGlobal);
+    SAVE_STATE();
+    cached_call(module, cache, callee, argc);
+    LOAD_STATE();
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_call_local: {
-    int32_t locals = module->base_pointer;
-
-    Value callee = module->stack->values[locals + i1];
-
-    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+    Value callee = bp[i1];
+    int32_t argc = i2;
+    CallCache* cache = &module->call_caches[i3];
 
-    interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, i2);
+    INCREASE_IP(OP_CallLocal);
+    SAVE_STATE();
+    cached_call(module, cache, callee, argc);
+    LOAD_STATE();
 
-    goto *jmp_table[op];
+    DISPATCH();
   }
 
   case_make_and_store_lambda: {
-    int32_t new_pc = module->pc + 4;
-    Value lambda = MAKE_FUNCTION(new_pc, i3);
+    Value lambda = MAKE_FUNCTION(i4);
 
-    module->stack->values[i1] = lambda;
+    values[i1] = lambda;
 
-    INCREASE_IP_BY(module, i2 + 1);
-    goto *jmp_table[op];
+    INCREASE_IP_BY(i2 + 1);
+    DISPATCH();
   }
 
   case_mul: {
-    Value a = stack_pop(module->stack);
-    Value b = stack_pop(module->stack);
+    Value a = pop();
+    Value b = pop();
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+    if (IS_INT(a) && IS_INT(b)) {
+      QUICKEN(case_mul_int);
+    } else if (IS_FLOAT(a) && IS_FLOAT(b)) {
+      QUICKEN(case_mul_float);
+    }
 
-    stack_push(module->stack, MAKE_INTEGER(a * b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    push(generic_arithmetic(module, OP_Mul, b, a));
+    INCREASE_IP(OP_Mul);
+    DISPATCH();
+  }
+
+  case_mul_int: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      QUICKEN(case_mul);
+      goto case_mul;
+    }
+
+    sp[-2] = arithmetic(module, OP_Mul, b, a);
+    sp--;
+    INCREASE_IP(OP_Mul);
+    DISPATCH();
+  }
+
+  case_mul_float: {
+    Value a = sp[-1];
+    Value b = sp[-2];
+
+    if (!IS_FLOAT(a) || !IS_FLOAT(b)) {
+      QUICKEN(case_mul);
+      goto case_mul;
+    }
+
+    double result = GET_FLOAT(b) * GET_FLOAT(a);
+    sp[-2] = MAKE_FLOAT(result);
+    sp--;
+    INCREASE_IP(OP_Mul);
+    DISPATCH();
   }
 
   case_mul_const: {
-    Value a = stack_pop(module->stack);
-    Value b = constants.constants[i1];
+    Value a = pop();
+    Value b = cst(0);
 
-    ASSERT_FMT(get_type(a) == TYPE_INTEGER && get_type(b) == TYPE_INTEGER, "Expected integers, got %s and %s", type_of(a), type_of(b));
+    ASSERT_VERIFIED(get_type(b) == TYPE_INTEGER, "Expected integer constant");
 
-    stack_push(module->stack, MAKE_INTEGER(a * b));
-    INCREASE_IP(module);
-    goto *jmp_table[op];
+    if (IS_INT(a)) QUICKEN(case_mul_const_int);
+    push(generic_arithmetic(module, OP_Mul, a, b));
+    INCREASE_IP(OP_MulConst);
+    DISPATCH();
+  }
+
+  case_mul_const_int: {
+    Value a = sp[-1];
+    Value b = cst(0);
+
+    if (!IS_INT(a)) {
+      QUICKEN(case_mul_const);
+      goto case_mul_const;
+    }
+
+    sp[-1] = arithmetic(module, OP_Mul, a, b);
+    INCREASE_IP(OP_MulConst);
+    DISPATCH();
   }
 
   case_return_unit: {
     Frame fr = pop_frame(module);
-    module->stack->stack_pointer = fr.stack_pointer;
-    module->base_pointer = fr.base_ptr;
+    sp = values + fr.stack_pointer;
+    bp = values + fr.base_ptr;
+
+    push(unit_value);
+
+    pc = bytecode + fr.instruction_pointer;
+
+    DISPATCH();
+  }
+
+  case_load_local2: {
+    Value a = bp[i1];
+    Value b = bp[i2];
+    push(a);
+    push(b);
+    INCREASE_IP(OP_LoadLocal2);
+    DISPATCH();
+  }
+
+  case_add_locals: {
+    Value a = bp[i1];
+    Value b = bp[i2];
+
+    push(arithmetic(module, OP_Add, a, b));
+    INCREASE_IP(OP_AddLocals);
+    DISPATCH();
+  }
+
+  case_sub_locals: {
+    Value a = bp[i1];
+    Value b = bp[i2];
+
+    push(arithmetic(module, OP_Sub, a, b));
+    INCREASE_IP(OP_SubLocals);
+    DISPATCH();
+  }
+
+  case_mul_locals: {
+    Value a = bp[i1];
+    Value b = bp[i2];
+
+    push(arithmetic(module, OP_Mul, a, b));
+    INCREASE_IP(OP_MulLocals);
+    DISPATCH();
+  }
+
+  case_load_local_add_const: {
+    Value a = bp[i1];
+    Value b = cst(1);
+
+    push(arithmetic(module, OP_Add, a, b));
+    INCREASE_IP(OP_LoadLocalAddConst);
+    DISPATCH();
+  }
+
+  case_load_local_sub_const: {
+    Value a = bp[i1];
+    Value b = cst(1);
+
+    push(arithmetic(module, OP_Sub, a, b));
+    INCREASE_IP(OP_LoadLocalSubConst);
+    DISPATCH();
+  }
+
+  case_add_const_local: {
+    Value a = bp[i1];
+    Value b = cst(2);
+
+    bp[i2] = arithmetic(module, OP_Add, a, b);
+    INCREASE_IP(OP_AddConstLocal);
+    DISPATCH();
+  }
+
+  case_sub_const_local: {
+    Value a = bp[i1];
+    Value b = cst(2);
+
+    bp[i2] = arithmetic(module, OP_Sub, a, b);
+    INCREASE_IP(OP_SubConstLocal);
+    DISPATCH();
+  }
+
+  case_load_local_list_get: {
+    Value list = bp[i1];
+    uint32_t idx = GET_INT(i2);
+    ASSERT_FMT(get_type(list) == TYPE_LIST, "Invalid list type at IPC %d", (int32_t) (pc - bytecode));
+    HeapValue* l = GET_PTR(list);
+    ASSERT(idx < l->length, "Index out of bounds");
+    push(l->as_ptr[idx]);
+    INCREASE_IP(OP_LoadLocalListGet);
+    DISPATCH();
+  }
+
+  case_call_native: {
+    Native nfun = module->linked_natives[i1];
+    int32_t argc = i2;
+
+    Value* args = pop_n(argc);
+
+    SAVE_STATE();
+    Value ret = nfun(argc, module, args);
+    LOAD_STATE();
+
+    push(ret);
+    INCREASE_IP(OP_CallNative);
+    DISPATCH();
+  }
+
+  case_tail_call: {
+    Value callee = pop();
+    int32_t argc = i1;
+
+    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+    INCREASE_IP(OP_TailCall);
+    SAVE_STATE();
+    tail_interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, argc);
+    LOAD_STATE();
+
+    DISPATCH();
+  }
+
+  case_tail_call_global: {
+    Value callee = values[i1];
+    int32_t argc = i2;
+
+    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+    INCREASE_IP(OP_TailCallGlobal);
+    SAVE_STATE();
+    tail_interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, argc);
+    LOAD_STATE();
+
+    DISPATCH();
+  }
+
+  case_tail_call_local: {
+    Value callee = bp[i1];
+    int32_t argc = i2;
+
+    ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+    INCREASE_IP(OP_TailCallLocal);
+    SAVE_STATE();
+    tail_interpreter_table[(callee & MASK_SIGNATURE) == SIGNATURE_FUNCTION](module, callee, argc);
+    LOAD_STATE();
+
+    DISPATCH();
+  }
+
+  // Switch tables follow their instruction. Entries hold the offset of their
+  // case, relative to the entry itself, and their key.
+
+  case_switch: {
+    Value key = pop();
+
+    // Boxed integers are outside the range of the keys.
+    if (!IS_INT(key)) {
+      ASSERT(IS_INT64(key), "Expected integer");
+      INCREASE_IP_BY(i1);
+      DISPATCH();
+    }
+
+    uint32_t idx = (uint32_t) GET_INT(key) - (uint32_t) i3;
+    if (idx >= (uint32_t) i2) {
+      INCREASE_IP_BY(i1);
+      DISPATCH();
+    }
+
+    pc += code_words(OP_Switch) + idx * code_words(OP_SwitchCase);
+    INCREASE_IP_BY(i1);
+    DISPATCH();
+  }
+
+  case_switch_sparse: {
+    Value key = pop();
+
+    // Boxed integers are outside the range of the keys.
+    if (!IS_INT(key)) {
+      ASSERT(IS_INT64(key), "Expected integer");
+      INCREASE_IP_BY(i1);
+      DISPATCH();
+    }
+
+    uint32_t k = GET_INT(key);
+    int32_t* entries = pc + code_words(OP_SwitchSparse);
+    int32_t low = 0, high = i2 - 1;
+
+    while (low <= high) {
+      int32_t mid = low + (high - low) / 2;
+      int32_t* entry = entries + mid * code_words(OP_SwitchCase);
+      uint32_t entry_key = entry[2];
+
+      if (entry_key == k) {
+        pc = entry + entry[1];
+        DISPATCH();
+      }
+
+      if (entry_key < k) low = mid + 1;
+      else high = mid - 1;
+    }
+
+    INCREASE_IP_BY(i1);
+    DISPATCH();
+  }
+
+  case_switch_case: {
+    THROW("Switch table entries are not executable");
+  }
+
+  case_constructor_tag: {
+    Value list = pop();
+    ASSERT(get_type(list) == TYPE_LIST, "Invalid list type");
+
+    HeapValue* l = GET_PTR(list);
+    ASSERT((uint32_t) i1 < l->length, "Index out of bounds");
+
+    push(MAKE_INTEGER(constructor_tag(module, l->as_ptr[i1])));
+    INCREASE_IP(OP_ConstructorTag);
+    DISPATCH();
+  }
+
+  case_count: {
+    module->profile->counts[i1]++;
+    INCREASE_IP(OP_Count);
+    DISPATCH();
+  }
+
+  case_exit: {
+    SAVE_STATE();
+    return sp[-1];
+  }
+
+  // Register instructions (see translate_registers) name frame slots relative
+  // to bp. Arithmetic ones write their result to bp[i1], and leave the stack
+  // pointer at bp + i2, just above the operand stack.
+
+  case_rmove: {
+    bp[i1] = bp[i2];
+    INCREASE_IP(OP_RMove);
+    DISPATCH();
+  }
+
+  case_rload_constant: {
+    bp[i1] = cst(1);
+    INCREASE_IP(OP_RLoadConstant);
+    DISPATCH();
+  }
+
+  case_radd: {
+    Value a = bp[i3];
+    Value b = bp[i4];
+
+    bp[i1] = arithmetic(module, OP_Add, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RAdd);
+    DISPATCH();
+  }
+
+  case_rsub: {
+    Value a = bp[i3];
+    Value b = bp[i4];
+
+    bp[i1] = arithmetic(module, OP_Sub, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RSub);
+    DISPATCH();
+  }
+
+  case_rmul: {
+    Value a = bp[i3];
+    Value b = bp[i4];
+
+    bp[i1] = arithmetic(module, OP_Mul, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RMul);
+    DISPATCH();
+  }
 
-    Value unit = MAKE_LIST(module->stack, (Value[3]) {
-      MAKE_SPECIAL(),
-      MAKE_STRING(module->stack, "unit"),
-      MAKE_STRING(module->stack, "unit")
-    }, 3);
-    stack_push(module->stack, unit);
+  case_radd_const: {
+    Value a = bp[i3];
+    Value b = cst(3);
 
-    module->pc = fr.instruction_pointer;
+    bp[i1] = arithmetic(module, OP_Add, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RAddConst);
+    DISPATCH();
+  }
+
+  case_rsub_const: {
+    Value a = bp[i3];
+    Value b = cst(3);
+
+    bp[i1] = arithmetic(module, OP_Sub, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RSubConst);
+    DISPATCH();
+  }
 
-    if (does_return) return unit;
+  case_rmul_const: {
+    Value a = bp[i3];
+    Value b = cst(3);
 
-    goto *jmp_table[op];
+    bp[i1] = arithmetic(module, OP_Mul, a, b);
+    sp = bp + i2;
+    INCREASE_IP(OP_RMulConst);
+    DISPATCH();
+  }
+
+  // Compares bp[i3] with bp[i4] using comparison i1, and pushes the result
+  // to bp[i2].
+  case_rcompare: {
+    static void* int_comparisons[] = {
+      [KindGreaterThan] = &&rcmp_int_gt, [KindEqualTo] = &&rcmp_int_eq,
+      [KindAnd] = &&rcmp_int_and, [KindOr] = &&rcmp_int_or };
+
+    a = bp[i3];
+    b = bp[i4];
+
+    // The result is written to sp[-1].
+    sp = bp + i2 + 1;
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      sp[-1] = comparison_table[i1](a, b);
+      goto rcmp_int_next;
+    }
+
+    goto *int_comparisons[i1];
+
+    rcmp_int_gt: { sp[-1] = MAKE_INTEGER((int32_t) GET_INT(a) > (int32_t) GET_INT(b)); goto rcmp_int_next; }
+    rcmp_int_eq: { sp[-1] = MAKE_INTEGER(a == b); goto rcmp_int_next; }
+    rcmp_int_and: { sp[-1] = MAKE_INTEGER(GET_INT(a) && GET_INT(b)); goto rcmp_int_next; }
+    rcmp_int_or: { sp[-1] = MAKE_INTEGER(GET_INT(a) || GET_INT(b)); goto rcmp_int_next; }
+
+    rcmp_int_next: {
+      INCREASE_IP(OP_RCompare);
+      DISPATCH();
+    }
+  }
+
+  // Conditional jumps read their operands from locals and jump by i1.
+
+  case_rjump_else_rel: {
+    Value value = bp[i2];
+    ASSERT(get_type(value) == TYPE_INTEGER, "Invalid value type")
+    INCREASE_IP_BY(GET_INT(value) == 0 ? i1 : code_words(OP_RJumpElseRel));
+    DISPATCH();
+  }
+
+  case_rjump_else_rel_cmp: {
+    static void* int_comparisons[] = {
+      [KindGreaterThan] = &&rjcmp_int_gt, [KindEqualTo] = &&rjcmp_int_eq,
+      [KindAnd] = &&rjcmp_int_and, [KindOr] = &&rjcmp_int_or };
+
+    a = bp[i3];
+    b = bp[i4];
+
+    uint32_t res;
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      Value cmp = comparison_table[i2](a, b);
+      ASSERT_VERIFIED(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+
+      res = GET_INT(cmp);
+      goto rjcmp_int_next;
+    }
+
+    goto *int_comparisons[i2];
+
+    rjcmp_int_gt: { res = (int32_t) GET_INT(a) > (int32_t) GET_INT(b); goto rjcmp_int_next; }
+    rjcmp_int_eq: { res = a == b; goto rjcmp_int_next; }
+    rjcmp_int_and: { res = GET_INT(a) && GET_INT(b); goto rjcmp_int_next; }
+    rjcmp_int_or: { res = GET_INT(a) || GET_INT(b); goto rjcmp_int_next; }
+
+    rjcmp_int_next: {
+      INCREASE_IP_BY(res == 0 ? i1 : code_words(OP_RJumpElseRelCmp));
+      DISPATCH();
+    }
+  }
+
+  case_rijump_else_rel_cmp: {
+    static void* icomparison_table[] = {
+      [KindEqualTo] = &&ricmp_eq, [KindAnd] = &&ricmp_and, [KindOr] = &&ricmp_or };
+
+    a = bp[i3];
+    b = bp[i4];
+
+    if (!IS_INT(a) || !IS_INT(b)) {
+      ASSERT(IS_INTEGER(a) && IS_INTEGER(b), "Expected integers");
+      bool res = compare_int64(kind_comparison(i2), GET_INT64(a), GET_INT64(b));
+      INCREASE_IP_BY(!res ? i1 : code_words(OP_RIJumpElseRelCmp));
+      DISPATCH();
+    }
+
+    uint32_t res;
+
+    goto *icomparison_table[i2];
+
+    ricmp_eq: { res = GET_INT(a) == GET_INT(b); goto ricmp_next; }
+    ricmp_and: { res = GET_INT(a) & GET_INT(b); goto ricmp_next; }
+    ricmp_or: { res = GET_INT(a) | GET_INT(b); goto ricmp_next; }
+
+    ricmp_next: {
+      INCREASE_IP_BY(res == 0 ? i1 : code_words(OP_RIJumpElseRelCmp));
+      DISPATCH();
+    }
+  }
+
+  case_rjump_else_rel_cmp_constant: {
+    Value a = bp[i2];
+    Value b = cst(2);
+
+    Value cmp = compare_eq(a, b);
+    ASSERT_VERIFIED(get_type(cmp) == TYPE_INTEGER, "Expected integer");
+
+    INCREASE_IP_BY(GET_INT(cmp) == 0 ? i1 : code_words(OP_RJumpElseRelCmpConst));
+    DISPATCH();
+  }
+
+  case_rijump_else_rel_cmp_constant: {
+    static void* icomparison_table[] = {
+      &&ricmp_cst_lt, &&ricmp_cst_gt, &&ricmp_cst_eq, &&ricmp_cst_neq,
+      &&ricmp_cst_lte, &&ricmp_cst_gte, &&ricmp_cst_and, &&ricmp_cst_or };
+
+    a = bp[i3];
+    b = cst(3);
+
+    if (!IS_INT(a)) {
+      ASSERT(IS_INT64(a), "Expected integers");
+      bool res = compare_int64(i2, GET_INT64(a), GET_INT64(b));
+      INCREASE_IP_BY(!res ? i1 : code_words(OP_RIJumpElseRelCmpConst));
+      DISPATCH();
+    }
+
+    uint32_t res;
+
+    goto *icomparison_table[i2];
+
+    ricmp_cst_lt: { res = (int32_t) GET_INT(a) < (int32_t) GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_gt: { res = (int32_t) GET_INT(a) > (int32_t) GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_eq: { res = GET_INT(a) == GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_neq: { res = GET_INT(a) != GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_gte: { res = (int32_t) GET_INT(a) >= (int32_t) GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_lte: { res = (int32_t) GET_INT(a) <= (int32_t) GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_and: { res = GET_INT(a) & GET_INT(b); goto ricmp_cst_next; }
+    ricmp_cst_or: { res = GET_INT(a) | GET_INT(b); goto ricmp_cst_next; }
+
+    ricmp_cst_next: {
+      INCREASE_IP_BY(res == 0 ? i1 : code_words(OP_RIJumpElseRelCmpConst));
+      DISPATCH();
+    }
+  }
+
+  case_rreturn: {
+    Value ret = bp[i1];
+
+    Frame fr = pop_frame(module);
+
+    sp = values + fr.stack_pointer;
+    bp = values + fr.base_ptr;
+    push(ret);
+
+    pc = bytecode + fr.instruction_pointer;
+
+    DISPATCH();
   }
 
   case_unknown: {
-    THROW_FMT("Unknown opcode: %d", op);
+    THROW_FMT("Unknown opcode: %d", module->opcodes[pc - bytecode]);
     return 0;
   }
+
+  #undef i1
+  #undef i2
+  #undef i3
+  #undef i4
+  #undef cst
+}
+
+void translate_bytecode(Deserialized *module) {
+  if (dispatch_table == NULL) run_interpreter(NULL, 0);
+
+  Bytecode bytecode = decode_bytecode(module->instrs, module->instr_count);
+  verify_bytecode(module, &bytecode);
+  optimize_bytecode(module, &bytecode);
+
+  link_natives(module, &bytecode);
+  detect_tail_calls(&bytecode);
+
+  bool* pure = optimizations.memoize ? find_pure_functions(&bytecode) : NULL;
+
+  // Stack depths are only defined on stack bytecode, so they are computed
+  // before translating to register form.
+  int32_t* depths = malloc((bytecode.instruction_count + 1) * sizeof(int32_t));
+  module->stack_depths = compute_stack_depths(&bytecode, depths);
+
+  translate_registers(&bytecode, depths, &module->stack_depths);
+  free(depths);
+
+  fuse_superinstructions(&bytecode);
+
+  // Instructions are laid out back to back, with only the words they use,
+  // and hot code first when a profile is used. The slots covered by fused
+  // instructions are dropped. When recording a profile, blocks start with a
+  // Count instruction, which jumps and entries land on.
+  Instruction* instrs = bytecode.instructions;
+  int32_t count = bytecode.instruction_count;
+  int32_t* positions = malloc((count + 1) * sizeof(int32_t));
+  int32_t* order = malloc((count + 1) * sizeof(int32_t));
+  int32_t length = 0;
+
+  Profile* profile = optimizations.use_profile != NULL ? profile_read(optimizations.use_profile, &bytecode) : NULL;
+  int32_t starts = order_instructions(&bytecode, profile != NULL ? profile->counts : NULL, order);
+  profile_free(profile);
+
+  module->profile = optimizations.write_profile != NULL ? profile_new(&bytecode) : NULL;
+  bool* counted = module->profile != NULL ? find_jump_targets(&bytecode) : NULL;
+
+  for (int32_t k = 0; k < starts; k++) {
+    int32_t i = order[k];
+    if (counted != NULL && (i == 0 || !falls_through(&instrs[order[k - 1]]))) counted[i] = true;
+
+    positions[i] = length;
+    length += code_words(instrs[i].opcode) + (counted != NULL && counted[i] ? code_words(OP_Count) : 0);
+  }
+  positions[count] = length;
+  length += code_words(OP_Exit);
+
+  Constants constants = module->constants;
+  int32_t* code = malloc(length * sizeof(int32_t));
+  Opcode* opcodes = calloc(length, sizeof(Opcode));
+  int32_t* stack_depths = calloc(length + 1, sizeof(int32_t));
+  FunctionDescriptor* functions = malloc((count + 1) * sizeof(FunctionDescriptor));
+
+  int32_t call_sites = 0, function_count = 0;
+  module->memo = pure != NULL ? memo_new(length, optimizations.memo_size) : NULL;
+
+  for (int32_t i = 0; i < count; i += instruction_size(&instrs[i])) {
+    Instruction instr = instrs[i];
+    int32_t at = positions[i];
+
+    if (counted != NULL && counted[i]) {
+      code[at] = (char*) dispatch_table[OP_Count] - (char*) dispatch_table[OP_LoadLocal];
+      code[at + 1] = i;
+      opcodes[at] = OP_Count;
+      at += code_words(OP_Count);
+    }
+
+    int32_t* words = &code[at];
+
+    if (instr.opcode == OP_CallGlobal || instr.opcode == OP_CallLocal) {
+      instr.operand3 = call_sites++;
+    }
+
+    // Offsets keep their conventions, but count words.
+    int32_t target = jump_target(instrs, i);
+    if (target >= 0) set_jump_target(&instr, 0, positions[target] - at);
+
+    // Headers are numbered in their original order, which pure follows.
+    bool is_header = instr.opcode == OP_MakeLambda || instr.opcode == OP_MakeAndStoreLambda;
+    int32_t function = is_header ? function_count++ : -1;
+
+    if (instr.opcode == OP_MakeLambda) {
+      functions[function] = (FunctionDescriptor) { positions[i + 1], instr.operand2 };
+      instr.operand3 = function;
+    } else if (instr.opcode == OP_MakeAndStoreLambda) {
+      functions[function] = (FunctionDescriptor) { positions[i + 1], instr.operand3 };
+      instr.operand4 = function;
+    }
+
+    int32_t operands[] = { instr.operand1, instr.operand2, instr.operand3, instr.operand4 };
+    int32_t operand_words = operand_count(instr.opcode);
+    int32_t offset = (char*) dispatch_table[instr.opcode] - (char*) dispatch_table[OP_LoadLocal];
+
+    words[0] = offset;
+    memcpy(&words[1], operands, operand_words * sizeof(int32_t));
+
+    int32_t constant_idx = constant_operand(&instr);
+    if (constant_idx >= 0) {
+      memcpy(&words[1 + operand_words], &constants.constants[constant_idx], sizeof(Value));
+    }
+
+    if (pure != NULL && is_header && pure[function]) memo_add(module->memo, positions[i + 1]);
+
+    opcodes[at] = instr.opcode;
+    stack_depths[positions[i]] = module->stack_depths[i];
+  }
+
+  // Frames entered from C return past the code, where they leave the loop.
+  int32_t exit_pc = positions[count];
+  code[exit_pc] = (char*) dispatch_table[OP_Exit] - (char*) dispatch_table[OP_LoadLocal];
+  opcodes[exit_pc] = OP_Exit;
+
+  free(positions);
+  free(order);
+  free(counted);
+  free(pure);
+  free(bytecode.instructions);
+  free(module->stack_depths);
+
+  module->code = code;
+  module->code_length = length;
+  module->exit_pc = exit_pc;
+  module->opcodes = opcodes;
+  module->stack_depths = stack_depths;
+  module->functions = functions;
+  module->function_count = function_count;
+  module->call_caches = new_call_caches(call_sites);
+  module->call_cache_count = call_sites;
+
+  // Counts are only kept by the interpreter.
+  module->jit = module->profile == NULL ? jit_new(module) : NULL;
 }
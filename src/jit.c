@@ -0,0 +1,1023 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <interpreter.h>
+#include <jit.h>
+#include <module.h>
+#include <stddef.h>
+#include <string.h>
+#include <value.h>
+
+#if ENABLE_JIT
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Register assignment of compiled code. The interpreter state lives in
+// callee-saved registers, so that it survives calls to the runtime.
+enum {
+  RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+  R8 = 8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+#define BP RBX
+#define SP R12
+#define MODULE R13
+#define VALUES R14
+#define INT_SIGNATURE R15
+
+// Condition codes, as encoded in Jcc and SETcc.
+enum {
+  CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7,
+  CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+};
+
+typedef struct {
+  int32_t site;
+  int32_t target;
+
+  // Whether the jump leaves compiled code at `target` instead of jumping to
+  // its instruction.
+  bool exits;
+} Fixup;
+
+typedef struct {
+  Deserialized* module;
+
+  uint8_t* code;
+  int32_t length;
+  int32_t capacity;
+
+  // Offset in `code` of the template of each code word, or -1.
+  int32_t* labels;
+
+  Fixup* fixups;
+  int32_t fixup_count;
+  int32_t fixup_capacity;
+
+  // Shared routines of the function.
+  int32_t save_state;
+  int32_t load_state;
+  int32_t resume;
+  int32_t ret;
+} Emitter;
+
+static void emit_byte(Emitter* e, uint8_t byte) {
+  if (e->length == e->capacity) {
+    e->capacity = e->capacity == 0 ? 1024 : e->capacity * 2;
+    e->code = realloc(e->code, e->capacity);
+  }
+
+  e->code[e->length++] = byte;
+}
+
+static void emit_dword(Emitter* e, uint32_t value) {
+  for (int32_t i = 0; i < 4; i++) emit_byte(e, value >> (i * 8));
+}
+
+static void emit_qword(Emitter* e, uint64_t value) {
+  for (int32_t i = 0; i < 8; i++) emit_byte(e, value >> (i * 8));
+}
+
+static void emit_rex(Emitter* e, bool wide, int32_t reg, int32_t rm) {
+  uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+  if (rex != 0x40) emit_byte(e, rex);
+}
+
+// op reg, [base + disp32]
+static void emit_mem(Emitter* e, bool wide, uint8_t opcode, int32_t reg, int32_t base, int32_t disp) {
+  emit_rex(e, wide, reg, base);
+  emit_byte(e, opcode);
+  emit_byte(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+  if ((base & 7) == RSP) emit_byte(e, 0x24);
+  emit_dword(e, disp);
+}
+
+// op rm, reg
+static void emit_reg(Emitter* e, bool wide, uint8_t opcode, int32_t reg, int32_t rm) {
+  emit_rex(e, wide, reg, rm);
+  emit_byte(e, opcode);
+  emit_byte(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void emit_load(Emitter* e, int32_t dst, int32_t base, int32_t disp) {
+  emit_mem(e, true, 0x8B, dst, base, disp);
+}
+
+static void emit_store(Emitter* e, int32_t base, int32_t disp, int32_t src) {
+  emit_mem(e, true, 0x89, src, base, disp);
+}
+
+static void emit_lea(Emitter* e, int32_t dst, int32_t base, int32_t disp) {
+  emit_mem(e, true, 0x8D, dst, base, disp);
+}
+
+static void emit_mov(Emitter* e, int32_t dst, int32_t src) {
+  emit_reg(e, true, 0x89, src, dst);
+}
+
+static void emit_mov_imm(Emitter* e, int32_t dst, uint64_t value) {
+  if (value <= UINT32_MAX) {
+    emit_rex(e, false, 0, dst);
+    emit_byte(e, 0xB8 + (dst & 7));
+    emit_dword(e, value);
+  } else {
+    emit_rex(e, true, 0, dst);
+    emit_byte(e, 0xB8 + (dst & 7));
+    emit_qword(e, value);
+  }
+}
+
+// Shifts by an immediate: `ext` selects the operation (4 = shl, 5 = shr,
+// 7 = sar).
+static void emit_shift(Emitter* e, int32_t ext, int32_t reg, uint8_t count) {
+  emit_rex(e, true, 0, reg);
+  emit_byte(e, 0xC1);
+  emit_byte(e, 0xC0 | (ext << 3) | (reg & 7));
+  emit_byte(e, count);
+}
+
+static void emit_push(Emitter* e, int32_t reg) {
+  emit_rex(e, false, 0, reg);
+  emit_byte(e, 0x50 + (reg & 7));
+}
+
+static void emit_pop(Emitter* e, int32_t reg) {
+  emit_rex(e, false, 0, reg);
+  emit_byte(e, 0x58 + (reg & 7));
+}
+
+static void emit_call_address(Emitter* e, void* function) {
+  emit_mov_imm(e, RAX, (uint64_t) function);
+  emit_byte(e, 0xFF);
+  emit_byte(e, 0xD0);
+}
+
+static void emit_call_local(Emitter* e, int32_t offset) {
+  emit_byte(e, 0xE8);
+  emit_dword(e, offset - (e->length + 4));
+}
+
+static void emit_jmp_local(Emitter* e, int32_t offset) {
+  emit_byte(e, 0xE9);
+  emit_dword(e, offset - (e->length + 4));
+}
+
+static void add_fixup(Emitter* e, int32_t target, bool exits) {
+  if (e->fixup_count == e->fixup_capacity) {
+    e->fixup_capacity = e->fixup_capacity == 0 ? 64 : e->fixup_capacity * 2;
+    e->fixups = realloc(e->fixups, e->fixup_capacity * sizeof(Fixup));
+  }
+
+  e->fixups[e->fixup_count++] = (Fixup) { e->length, target, exits };
+}
+
+// Jumps to the template of the instruction at `target` when `cc` holds, or
+// unconditionally when `cc` is negative.
+static void emit_jump(Emitter* e, int32_t cc, int32_t target, bool exits) {
+  if (cc < 0) {
+    emit_byte(e, 0xE9);
+  } else {
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | cc);
+  }
+
+  add_fixup(e, target, exits);
+  emit_dword(e, 0);
+}
+
+// Leaves compiled code for the interpreter at instruction `pc`, with the
+// state as it was before the instruction.
+static void emit_exit(Emitter* e, int32_t cc, int32_t pc) {
+  emit_jump(e, cc, pc, true);
+}
+
+static void emit_push_value(Emitter* e, int32_t reg) {
+  emit_store(e, SP, 0, reg);
+  emit_lea(e, SP, SP, 8);
+}
+
+// Leaves compiled code at `pc` unless `reg` holds an integer.
+static void emit_check_int(Emitter* e, int32_t reg, int32_t pc) {
+  emit_mov(e, RDX, reg);
+  emit_shift(e, 5, RDX, 48);
+
+  // cmp edx, imm32
+  emit_byte(e, 0x81);
+  emit_byte(e, 0xFA);
+  emit_dword(e, SIGNATURE_INTEGER >> 48);
+
+  emit_exit(e, CC_NE, pc);
+}
+
+// Boxes the 32-bit result in eax as an integer.
+static void emit_box_int(Emitter* e) {
+  emit_reg(e, true, 0x09, INT_SIGNATURE, RAX);
+}
+
+// Integer operation on eax and ecx, leaving its result in eax. Leaves
+// compiled code at `pc` on overflow, for the interpreter to box the result.
+static void emit_int_op(Emitter* e, Opcode opcode, int32_t pc) {
+  switch (opcode) {
+    case OP_Add: emit_reg(e, false, 0x01, RCX, RAX); break;
+    case OP_Sub: emit_reg(e, false, 0x29, RCX, RAX); break;
+    case OP_Mul:
+      emit_byte(e, 0x0F);
+      emit_byte(e, 0xAF);
+      emit_byte(e, 0xC0 | (RAX << 3) | RCX);
+      break;
+    default:
+      THROW_FMT("No integer template for opcode %d", opcode);
+  }
+
+  emit_exit(e, CC_O, pc);
+}
+
+// Compares eax with ecx (as signed 32-bit integers), and
+// returns the condition that holds when comparison `kind` is false, or -1
+// when it has no template.
+static int32_t emit_int_compare(Emitter* e, int32_t kind) {
+  switch (kind) {
+    case LessThan: case GreaterThan: case EqualTo: case NotEqualTo:
+    case LessThanOrEqualTo: case GreaterThanOrEqualTo:
+      emit_reg(e, false, 0x39, RCX, RAX);
+      break;
+    case And:
+      emit_reg(e, false, 0x85, RCX, RAX);
+      break;
+    case Or:
+      emit_reg(e, false, 0x09, RCX, RAX);
+      break;
+    default:
+      return -1;
+  }
+
+  switch (kind) {
+    case LessThan: return CC_GE;
+    case GreaterThan: return CC_LE;
+    case EqualTo: return CC_NE;
+    case NotEqualTo: return CC_E;
+    case LessThanOrEqualTo: return CC_G;
+    case GreaterThanOrEqualTo: return CC_L;
+    default: return CC_E;
+  }
+}
+
+// The Comparison of a ComparisonKind. Only the kinds with an integer fast
+// path in the interpreter are compiled.
+static int32_t interpreter_comparison(int32_t kind) {
+  switch (kind) {
+    case KindGreaterThan: return GreaterThan;
+    case KindEqualTo: return EqualTo;
+    default: return -1;
+  }
+}
+
+static Value read_constant(int32_t* words) {
+  Value value;
+  memcpy(&value, words, sizeof(Value));
+  return value;
+}
+
+// Runtime entry points of compiled code. Compiled functions always run their
+// frame to completion: when the rest of it cannot run compiled, the
+// interpreter runs it until it returns, to the Exit instruction (see
+// run_call).
+
+// Enters the callee, and returns its compiled body, or NULL once the call is
+// complete.
+static void* jit_enter(Deserialized* module, Value callee, int32_t argc) {
+  ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+  if (!IS_FUN(callee)) {
+    op_native_call(module, callee, argc);
+    return NULL;
+  }
+
+  FunctionDescriptor* function = get_function(module, callee);
+  MemoTable* memo = memo_table(module->memo, function->entry);
+
+  if (memo != NULL && memoized_call(module, memo, function->entry, function->local_space, argc)) {
+    return NULL;
+  }
+
+  JitFunction compiled = jit_lookup(module, function->entry);
+  if (compiled == NULL) {
+    run_call(module, function->entry, function->local_space, argc, NULL);
+    return NULL;
+  }
+
+  // The body may leave to the interpreter, which runs the frame until it
+  // returns to the Exit instruction.
+  module->pc = module->exit_pc;
+  push_frame_at(module, function->entry, function->local_space, argc);
+  return module->jit->entries[function->entry];
+}
+
+// Same as jit_enter, for calls replacing the current frame.
+static void* jit_tail_call(Deserialized* module, Value callee, int32_t argc) {
+  ASSERT(IS_FUN(callee) || IS_PTR(callee), "Invalid callee type");
+
+  if (IS_FUN(callee)) {
+    op_tail_call(module, callee, argc);
+    if (jit_lookup(module, module->pc) != NULL) return module->jit->entries[module->pc];
+  } else {
+    op_native_call(module, callee, argc);
+  }
+
+  run_interpreter(module, module->pc);
+  return NULL;
+}
+
+static void jit_resume(Deserialized* module) {
+  run_interpreter(module, module->pc);
+}
+
+static void jit_call_native(Deserialized* module, int32_t native, int32_t argc) {
+  Native nfun = module->linked_natives[native];
+  Stack* stack = module->stack;
+
+  Value* args = stack_pop_n(stack, argc);
+  Value ret = nfun(argc, module, args);
+
+  stack_push(stack, ret);
+}
+
+// Bodies keep the stack aligned for calls to the runtime.
+static void emit_enter_body(Emitter* e) {
+  emit_byte(e, 0x48); emit_byte(e, 0x83); emit_byte(e, 0xEC); emit_byte(e, 0x08);
+}
+
+static void emit_leave_body(Emitter* e) {
+  emit_byte(e, 0x48); emit_byte(e, 0x83); emit_byte(e, 0xC4); emit_byte(e, 0x08);
+}
+
+static void emit_routines(Emitter* e) {
+  // Stores sp, bp and the pc in eax to the module.
+  e->save_state = e->length;
+  emit_mem(e, false, 0x89, RAX, MODULE, offsetof(Deserialized, pc));
+  emit_mov(e, RAX, SP);
+  emit_reg(e, true, 0x29, VALUES, RAX);
+  emit_shift(e, 7, RAX, 3);
+  emit_load(e, RCX, MODULE, offsetof(Deserialized, stack));
+  emit_mem(e, false, 0x89, RAX, RCX, offsetof(Stack, stack_pointer));
+  emit_mov(e, RAX, BP);
+  emit_reg(e, true, 0x29, VALUES, RAX);
+  emit_shift(e, 7, RAX, 3);
+  emit_mem(e, false, 0x89, RAX, MODULE, offsetof(Deserialized, base_pointer));
+  emit_byte(e, 0xC3);
+
+  // Reloads the state, after calls that may have moved the stack.
+  e->load_state = e->length;
+  emit_load(e, RCX, MODULE, offsetof(Deserialized, stack));
+  emit_load(e, VALUES, RCX, offsetof(Stack, values));
+  emit_mem(e, true, 0x63, RAX, RCX, offsetof(Stack, stack_pointer));
+  emit_shift(e, 4, RAX, 3);
+  emit_reg(e, true, 0x01, VALUES, RAX);
+  emit_mov(e, SP, RAX);
+  emit_mem(e, true, 0x63, RAX, MODULE, offsetof(Deserialized, base_pointer));
+  emit_shift(e, 4, RAX, 3);
+  emit_reg(e, true, 0x01, VALUES, RAX);
+  emit_mov(e, BP, RAX);
+  emit_byte(e, 0xC3);
+
+  // Runs the rest of the frame in the interpreter, from the pc in eax.
+  e->resume = e->length;
+  emit_call_local(e, e->save_state);
+  emit_mov(e, RDI, MODULE);
+  emit_call_address(e, jit_resume);
+  emit_call_local(e, e->load_state);
+  emit_leave_body(e);
+  emit_byte(e, 0xC3);
+
+  // Returns the value in rsi, popping the frame as pop_frame does. Frames
+  // are 12 bytes.
+  e->ret = e->length;
+  emit_mem(e, false, 0xFF, 1, MODULE, offsetof(Deserialized, call_stack.frame_pointer));
+  emit_mem(e, true, 0x63, RAX, MODULE, offsetof(Deserialized, call_stack.frame_pointer));
+  emit_mov(e, RCX, RAX);
+  emit_shift(e, 4, RAX, 1);
+  emit_reg(e, true, 0x01, RCX, RAX);
+  emit_shift(e, 4, RAX, 2);
+  emit_load(e, RCX, MODULE, offsetof(Deserialized, call_stack.frames));
+  emit_reg(e, true, 0x01, RAX, RCX);
+  emit_mem(e, false, 0x8B, RAX, RCX, offsetof(Frame, instruction_pointer));
+  emit_mem(e, false, 0x89, RAX, MODULE, offsetof(Deserialized, pc));
+  emit_mem(e, true, 0x63, RAX, RCX, offsetof(Frame, stack_pointer));
+  emit_shift(e, 4, RAX, 3);
+  emit_reg(e, true, 0x01, VALUES, RAX);
+  emit_store(e, RAX, 0, RSI);
+  emit_lea(e, SP, RAX, 8);
+  emit_mem(e, true, 0x63, RAX, RCX, offsetof(Frame, base_ptr));
+  emit_shift(e, 4, RAX, 3);
+  emit_reg(e, true, 0x01, VALUES, RAX);
+  emit_mov(e, BP, RAX);
+  emit_leave_body(e);
+  emit_byte(e, 0xC3);
+}
+
+static void emit_save_state(Emitter* e, int32_t pc) {
+  emit_mov_imm(e, RAX, pc);
+  emit_call_local(e, e->save_state);
+}
+
+// Calls the callee in rsi with `argc` arguments, saving the state past the
+// call instruction like the interpreter. Saving the state preserves rsi.
+static void emit_call(Emitter* e, int32_t next, int32_t argc, bool tail) {
+  emit_save_state(e, next);
+  emit_mov(e, RDI, MODULE);
+  emit_mov_imm(e, RDX, (uint32_t) argc);
+  emit_call_address(e, tail ? (void*) jit_tail_call : (void*) jit_enter);
+  emit_mov(e, RBP, RAX);
+  emit_call_local(e, e->load_state);
+
+  if (tail) {
+    // The callee body replaces this one, or the frame is complete.
+    emit_leave_body(e);
+    emit_reg(e, true, 0x85, RBP, RBP);
+    emit_byte(e, 0x74);
+    emit_byte(e, 0x02);
+    emit_byte(e, 0xFF);
+    emit_byte(e, 0xE5);
+    emit_byte(e, 0xC3);
+  } else {
+    emit_reg(e, true, 0x85, RBP, RBP);
+    emit_byte(e, 0x74);
+    emit_byte(e, 0x02);
+    emit_byte(e, 0xFF);
+    emit_byte(e, 0xD5);
+  }
+}
+
+// Pops the jump condition, or loads it from the local in `slot`.
+static void emit_load_operand(Emitter* e, int32_t reg, int32_t slot, bool pops) {
+  if (pops) {
+    emit_load(e, reg, SP, -8);
+  } else {
+    emit_load(e, reg, BP, slot * 8);
+  }
+}
+
+// Emits the template of the instruction at `pc`. Returns false when it has
+// none, in which case it leaves compiled code.
+// Tables with fewer keys are searched linearly.
+#define SWITCH_LINEAR_KEYS 4
+
+// Searches the keys of the table entries from `low` to `high` (excluded) for
+// eax, and jumps to the case of the matching one, or to `fallback`. Keys are
+// sorted, so larger tables are split around their middle key.
+static void emit_switch_search(Emitter* e, int32_t table, int32_t low, int32_t high, int32_t fallback) {
+  int32_t* code = e->module->code;
+  int32_t size = code_words(OP_SwitchCase);
+
+  while (high - low > SWITCH_LINEAR_KEYS) {
+    int32_t mid = low + (high - low) / 2;
+    int32_t entry = table + mid * size;
+
+    emit_mov_imm(e, RCX, (uint32_t) code[entry + 2]);
+    emit_reg(e, false, 0x39, RCX, RAX);
+    emit_jump(e, CC_E, entry + code[entry + 1], false);
+
+    // ja to the upper half, emitted after the lower one.
+    emit_byte(e, 0x0F);
+    emit_byte(e, 0x80 | CC_A);
+    int32_t site = e->length;
+    emit_dword(e, 0);
+
+    emit_switch_search(e, table, low, mid, fallback);
+
+    int32_t rel = e->length - (site + 4);
+    memcpy(&e->code[site], &rel, sizeof(int32_t));
+    low = mid + 1;
+  }
+
+  for (int32_t k = low; k < high; k++) {
+    int32_t entry = table + k * size;
+    int32_t target = entry + code[entry + 1];
+    if (target == fallback) continue;
+
+    emit_mov_imm(e, RCX, (uint32_t) code[entry + 2]);
+    emit_reg(e, false, 0x39, RCX, RAX);
+    emit_jump(e, CC_E, target, false);
+  }
+
+  emit_jump(e, -1, fallback, false);
+}
+
+static bool emit_instruction(Emitter* e, int32_t pc) {
+  Deserialized* module = e->module;
+  int32_t* words = &module->code[pc];
+  Opcode opcode = module->opcodes[pc];
+  int32_t next = pc + code_words(opcode);
+
+  int32_t i1 = words[1], i2 = words[2], i3 = words[3], i4 = words[4];
+
+  switch (opcode) {
+    case OP_LoadLocal:
+      emit_load(e, RAX, BP, i1 * 8);
+      emit_push_value(e, RAX);
+      return true;
+
+    case OP_StoreLocal:
+      emit_lea(e, SP, SP, -8);
+      emit_load(e, RAX, SP, 0);
+      emit_store(e, BP, i1 * 8, RAX);
+      return true;
+
+    case OP_LoadConstant:
+      emit_mov_imm(e, RAX, read_constant(&words[1]));
+      emit_push_value(e, RAX);
+      return true;
+
+    case OP_LoadGlobal:
+      emit_load(e, RAX, VALUES, i1 * 8);
+      emit_push_value(e, RAX);
+      return true;
+
+    case OP_StoreGlobal:
+      emit_lea(e, SP, SP, -8);
+      emit_load(e, RAX, SP, 0);
+      emit_store(e, VALUES, i1 * 8, RAX);
+      return true;
+
+    case OP_LoadLocal2:
+      emit_load(e, RAX, BP, i1 * 8);
+      emit_push_value(e, RAX);
+      emit_load(e, RAX, BP, i2 * 8);
+      emit_push_value(e, RAX);
+      return true;
+
+    case OP_RMove:
+      emit_load(e, RAX, BP, i2 * 8);
+      emit_store(e, BP, i1 * 8, RAX);
+      return true;
+
+    case OP_RLoadConstant:
+      emit_mov_imm(e, RAX, read_constant(&words[2]));
+      emit_store(e, BP, i1 * 8, RAX);
+      return true;
+
+    // Stack arithmetic: b is below a, and the result replaces b.
+    case OP_Add: case OP_Sub: case OP_Mul:
+      emit_load(e, RCX, SP, -8);
+      emit_load(e, RAX, SP, -16);
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+      emit_int_op(e, opcode, pc);
+      emit_box_int(e);
+      emit_store(e, SP, -16, RAX);
+      emit_lea(e, SP, SP, -8);
+      return true;
+
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+    case OP_LoadLocalAddConst: case OP_LoadLocalSubConst:
+    case OP_AddConstLocal: case OP_SubConstLocal:
+    case OP_RAddConst: case OP_RSubConst: case OP_RMulConst: {
+      int32_t operands = operand_count(opcode);
+      Value constant = read_constant(&words[1 + operands]);
+      if (!IS_INT(constant)) return false;
+
+      Opcode operation;
+      int32_t src;
+
+      switch (opcode) {
+        case OP_AddConst: case OP_LoadLocalAddConst: case OP_AddConstLocal:
+        case OP_RAddConst:
+          operation = OP_Add;
+          break;
+        case OP_MulConst: case OP_RMulConst:
+          operation = OP_Mul;
+          break;
+        default:
+          operation = OP_Sub;
+      }
+
+      if (opcode == OP_AddConst || opcode == OP_SubConst || opcode == OP_MulConst) {
+        emit_load(e, RAX, SP, -8);
+      } else {
+        src = opcode == OP_RAddConst || opcode == OP_RSubConst || opcode == OP_RMulConst ? i3 : i1;
+        emit_load(e, RAX, BP, src * 8);
+      }
+
+      emit_check_int(e, RAX, pc);
+      emit_mov_imm(e, RCX, (uint32_t) GET_INT(constant));
+      emit_int_op(e, operation, pc);
+      emit_box_int(e);
+
+      switch (opcode) {
+        case OP_AddConst: case OP_SubConst: case OP_MulConst:
+          emit_store(e, SP, -8, RAX);
+          break;
+        case OP_LoadLocalAddConst: case OP_LoadLocalSubConst:
+          emit_push_value(e, RAX);
+          break;
+        case OP_AddConstLocal: case OP_SubConstLocal:
+          emit_store(e, BP, i2 * 8, RAX);
+          break;
+        default:
+          emit_store(e, BP, i1 * 8, RAX);
+          emit_lea(e, SP, BP, i2 * 8);
+      }
+      return true;
+    }
+
+    case OP_AddLocals: case OP_SubLocals: case OP_MulLocals:
+      emit_load(e, RAX, BP, i1 * 8);
+      emit_load(e, RCX, BP, i2 * 8);
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+      emit_int_op(e, opcode == OP_AddLocals ? OP_Add : opcode == OP_SubLocals ? OP_Sub : OP_Mul, pc);
+      emit_box_int(e);
+      emit_push_value(e, RAX);
+      return true;
+
+    case OP_RAdd: case OP_RSub: case OP_RMul:
+      emit_load(e, RAX, BP, i3 * 8);
+      emit_load(e, RCX, BP, i4 * 8);
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+      emit_int_op(e, opcode == OP_RAdd ? OP_Add : opcode == OP_RSub ? OP_Sub : OP_Mul, pc);
+      emit_box_int(e);
+      emit_store(e, BP, i1 * 8, RAX);
+      emit_lea(e, SP, BP, i2 * 8);
+      return true;
+
+    // Comparisons producing a value. The stack form compares the deeper
+    // operand with the top one.
+    case OP_Compare: case OP_RCompare: {
+      int32_t kind = interpreter_comparison(i1);
+      if (kind < 0) return false;
+
+      if (opcode == OP_Compare) {
+        emit_load(e, RAX, SP, -16);
+        emit_load(e, RCX, SP, -8);
+      } else {
+        emit_load(e, RAX, BP, i3 * 8);
+        emit_load(e, RCX, BP, i4 * 8);
+      }
+
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+
+      int32_t cc = emit_int_compare(e, kind);
+
+      // setcc al on the negated condition, then movzx eax, al.
+      emit_byte(e, 0x0F);
+      emit_byte(e, 0x90 | (cc ^ 1));
+      emit_byte(e, 0xC0);
+      emit_byte(e, 0x0F);
+      emit_byte(e, 0xB6);
+      emit_byte(e, 0xC0);
+      emit_box_int(e);
+
+      if (opcode == OP_Compare) {
+        emit_store(e, SP, -16, RAX);
+        emit_lea(e, SP, SP, -8);
+      } else {
+        emit_store(e, BP, i2 * 8, RAX);
+        emit_lea(e, SP, BP, (i2 + 1) * 8);
+      }
+      return true;
+    }
+
+    case OP_JumpRel:
+      emit_jump(e, -1, pc + i1, false);
+      return true;
+
+    case OP_JumpElseRel: case OP_RJumpElseRel: {
+      bool pops = opcode == OP_JumpElseRel;
+
+      emit_load_operand(e, RAX, i2, pops);
+      emit_check_int(e, RAX, pc);
+      if (pops) emit_lea(e, SP, SP, -8);
+
+      emit_reg(e, false, 0x85, RAX, RAX);
+      emit_jump(e, CC_E, pc + i1, false);
+      return true;
+    }
+
+    // The interpreter compares the top operand with the deeper one.
+    case OP_JumpElseRelCmp: case OP_RJumpElseRelCmp: {
+      int32_t kind = interpreter_comparison(i2);
+      if (kind < 0) return false;
+
+      if (opcode == OP_JumpElseRelCmp) {
+        emit_load(e, RAX, SP, -8);
+        emit_load(e, RCX, SP, -16);
+      } else {
+        emit_load(e, RAX, BP, i3 * 8);
+        emit_load(e, RCX, BP, i4 * 8);
+      }
+
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+      if (opcode == OP_JumpElseRelCmp) emit_lea(e, SP, SP, -16);
+
+      emit_jump(e, emit_int_compare(e, kind), pc + i1, false);
+      return true;
+    }
+
+    // Integer comparisons, of a ComparisonKind.
+    case OP_IJumpElseRelCmp: case OP_RIJumpElseRelCmp: {
+      int32_t kind = opcode == OP_IJumpElseRelCmp ? i1 : i2;
+      int32_t offset = opcode == OP_IJumpElseRelCmp ? i2 : i1;
+
+      switch (kind) {
+        case KindEqualTo: kind = EqualTo; break;
+        case KindAnd: kind = And; break;
+        case KindOr: kind = Or; break;
+        default: return false;
+      }
+
+      if (opcode == OP_IJumpElseRelCmp) {
+        emit_load(e, RAX, SP, -8);
+        emit_load(e, RCX, SP, -16);
+      } else {
+        emit_load(e, RAX, BP, i3 * 8);
+        emit_load(e, RCX, BP, i4 * 8);
+      }
+
+      // Boxed integers are compared by the interpreter.
+      emit_check_int(e, RAX, pc);
+      emit_check_int(e, RCX, pc);
+      if (opcode == OP_IJumpElseRelCmp) emit_lea(e, SP, SP, -16);
+
+      emit_jump(e, emit_int_compare(e, kind), pc + offset, false);
+      return true;
+    }
+
+    case OP_JumpElseRelCmpConst: case OP_RJumpElseRelCmpConst: {
+      bool pops = opcode == OP_JumpElseRelCmpConst;
+      Value constant = read_constant(&words[1 + operand_count(opcode)]);
+      if (!IS_INT(constant)) return false;
+
+      emit_load_operand(e, RAX, i2, pops);
+      emit_check_int(e, RAX, pc);
+      if (pops) emit_lea(e, SP, SP, -8);
+
+      emit_mov_imm(e, RCX, (uint32_t) GET_INT(constant));
+      emit_jump(e, emit_int_compare(e, EqualTo), pc + i1, false);
+      return true;
+    }
+
+    case OP_IJumpElseRelCmpConst: case OP_RIJumpElseRelCmpConst: {
+      bool pops = opcode == OP_IJumpElseRelCmpConst;
+      Value constant = read_constant(&words[1 + operand_count(opcode)]);
+      if (!IS_INT(constant) || i2 < LessThan || i2 > Or) return false;
+
+      emit_load_operand(e, RAX, i3, pops);
+      emit_check_int(e, RAX, pc);
+      if (pops) emit_lea(e, SP, SP, -8);
+
+      emit_mov_imm(e, RCX, (uint32_t) GET_INT(constant));
+      emit_jump(e, emit_int_compare(e, i2), pc + i1, false);
+      return true;
+    }
+
+    case OP_Switch: case OP_SwitchSparse:
+      emit_load(e, RAX, SP, -8);
+      emit_check_int(e, RAX, pc);
+      emit_lea(e, SP, SP, -8);
+      emit_switch_search(e, next, 0, i2, pc + i1);
+      return true;
+
+    case OP_Return:
+      emit_load(e, RSI, SP, -8);
+      emit_jmp_local(e, e->ret);
+      return true;
+
+    case OP_RReturn:
+      emit_load(e, RSI, BP, i1 * 8);
+      emit_jmp_local(e, e->ret);
+      return true;
+
+    case OP_ReturnConst:
+      emit_mov_imm(e, RSI, read_constant(&words[1]));
+      emit_jmp_local(e, e->ret);
+      return true;
+
+    case OP_Call: case OP_TailCall:
+      emit_load(e, RSI, SP, -8);
+      emit_lea(e, SP, SP, -8);
+      emit_call(e, next, i1, opcode == OP_TailCall);
+      return true;
+
+    case OP_CallGlobal: case OP_TailCallGlobal:
+      emit_load(e, RSI, VALUES, i1 * 8);
+      emit_call(e, next, i2, opcode == OP_TailCallGlobal);
+      return true;
+
+    case OP_CallLocal: case OP_TailCallLocal:
+      emit_load(e, RSI, BP, i1 * 8);
+      emit_call(e, next, i2, opcode == OP_TailCallLocal);
+      return true;
+
+    // Natives see the state of the call instruction, as in the interpreter.
+    case OP_CallNative:
+      emit_save_state(e, pc);
+      emit_mov(e, RDI, MODULE);
+      emit_mov_imm(e, RSI, (uint32_t) i1);
+      emit_mov_imm(e, RDX, (uint32_t) i2);
+      emit_call_address(e, jit_call_native);
+      emit_call_local(e, e->load_state);
+      return true;
+
+    default:
+      return false;
+  }
+}
+
+// Whether compiled code continues with the next instruction. Tail calls
+// complete the frame, and switches jump to one of their cases without
+// entering their table.
+static bool code_falls_through(Opcode opcode) {
+  switch (opcode) {
+    case OP_TailCall: case OP_TailCallGlobal: case OP_TailCallLocal:
+    case OP_Switch: case OP_SwitchSparse:
+      return false;
+    default: {
+      Instruction instr = { .opcode = opcode };
+      return falls_through(&instr);
+    }
+  }
+}
+
+static void* install(Jit* jit, uint8_t* code, int32_t length) {
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t size = (length + page - 1) / page * page;
+
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) return NULL;
+
+  memcpy(memory, code, length);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    return NULL;
+  }
+
+  jit->blocks = realloc(jit->blocks, (jit->block_count + 1) * sizeof(void*));
+  jit->block_sizes = realloc(jit->block_sizes, (jit->block_count + 1) * sizeof(size_t));
+  jit->blocks[jit->block_count] = memory;
+  jit->block_sizes[jit->block_count] = size;
+  jit->block_count++;
+
+  return memory;
+}
+
+// Compiles the instructions reachable from the function entry, laying out
+// fall-through chains contiguously. Instructions without a template end
+// their chain with an exit to the interpreter.
+static JitFunction compile(Deserialized* module, int32_t entry) {
+  int32_t length = module->code_length;
+
+  Emitter e = { 0 };
+  e.module = module;
+  e.labels = malloc(length * sizeof(int32_t));
+  for (int32_t i = 0; i < length; i++) e.labels[i] = -1;
+
+  emit_routines(&e);
+
+  // The body is called with the state in registers, and returns once the
+  // frame is complete.
+  int32_t body = e.length;
+  emit_enter_body(&e);
+
+  // Each instruction is queued at most once per jump to it.
+  int32_t* worklist = malloc((length + 1) * sizeof(int32_t));
+  int32_t pending = 0;
+  worklist[pending++] = entry;
+
+  while (pending > 0) {
+    int32_t pc = worklist[--pending];
+    if (e.labels[pc] >= 0) continue;
+
+    while (true) {
+      Opcode opcode = module->opcodes[pc];
+      int32_t fixups = e.fixup_count;
+
+      e.labels[pc] = e.length;
+      if (!emit_instruction(&e, pc)) {
+        e.length = e.labels[pc];
+        e.fixup_count = fixups;
+        emit_exit(&e, -1, pc);
+        break;
+      }
+
+      // Instructions may jump to several places, such as switches.
+      for (int32_t i = fixups; i < e.fixup_count; i++) {
+        int32_t target = e.fixups[i].target;
+        if (!e.fixups[i].exits && e.labels[target] < 0) worklist[pending++] = target;
+      }
+
+      if (!code_falls_through(opcode)) break;
+
+      pc += code_words(opcode);
+      if (e.labels[pc] >= 0) {
+        emit_jump(&e, -1, pc, false);
+        break;
+      }
+    }
+  }
+
+  // Exits hand the frame to the interpreter, from their instruction.
+  for (int32_t i = 0; i < e.fixup_count; i++) {
+    Fixup fixup = e.fixups[i];
+    int32_t target = e.labels[fixup.target];
+
+    if (fixup.exits) {
+      target = e.length;
+      emit_mov_imm(&e, RAX, fixup.target);
+      emit_jmp_local(&e, e.resume);
+    }
+
+    int32_t rel = target - (fixup.site + 4);
+    memcpy(&e.code[fixup.site], &rel, sizeof(int32_t));
+  }
+
+  // Entry from C: the state is loaded in callee-saved registers for the body,
+  // and saved back once it returns.
+  int32_t start = e.length;
+  emit_push(&e, RBX);
+  emit_push(&e, RBP);
+  emit_push(&e, R12);
+  emit_push(&e, R13);
+  emit_push(&e, R14);
+  emit_push(&e, R15);
+  emit_enter_body(&e);
+  emit_mov(&e, MODULE, RDI);
+  emit_mov_imm(&e, INT_SIGNATURE, SIGNATURE_INTEGER);
+  emit_call_local(&e, e.load_state);
+  emit_call_local(&e, body);
+  emit_mem(&e, false, 0x8B, RAX, MODULE, offsetof(Deserialized, pc));
+  emit_call_local(&e, e.save_state);
+  emit_leave_body(&e);
+  emit_pop(&e, R15);
+  emit_pop(&e, R14);
+  emit_pop(&e, R13);
+  emit_pop(&e, R12);
+  emit_pop(&e, RBP);
+  emit_pop(&e, RBX);
+  emit_byte(&e, 0xC3);
+
+  uint8_t* memory = install(module->jit, e.code, e.length);
+
+  free(worklist);
+  free(e.labels);
+  free(e.fixups);
+  free(e.code);
+
+  if (memory == NULL) return NULL;
+
+  module->jit->entries[entry] = memory + body;
+  return (JitFunction) (memory + start);
+}
+
+Jit* jit_new(Deserialized* module) {
+  Jit* jit = calloc(1, sizeof(Jit));
+  jit->call_counts = calloc(module->code_length + 1, sizeof(int32_t));
+  jit->functions = calloc(module->code_length + 1, sizeof(JitFunction));
+  jit->entries = calloc(module->code_length + 1, sizeof(void*));
+  return jit;
+}
+
+void jit_free(Jit* jit) {
+  if (jit == NULL) return;
+
+  for (int32_t i = 0; i < jit->block_count; i++) {
+    munmap(jit->blocks[i], jit->block_sizes[i]);
+  }
+
+  free(jit->blocks);
+  free(jit->block_sizes);
+  free(jit->call_counts);
+  free(jit->functions);
+  free(jit->entries);
+  free(jit);
+}
+
+JitFunction jit_lookup(Deserialized* module, int32_t ipc) {
+  Jit* jit = module->jit;
+  if (jit == NULL || module->call_stack.frame_pointer >= JIT_MAX_DEPTH) return NULL;
+
+  JitFunction function = jit->functions[ipc];
+  if (function != NULL) return function;
+
+  if (++jit->call_counts[ipc] != JIT_THRESHOLD) return NULL;
+
+  function = compile(module, ipc);
+  jit->functions[ipc] = function;
+  return function;
+}
+
+#else
+
+Jit* jit_new(Deserialized* module) {
+  return NULL;
+}
+
+void jit_free(Jit* jit) {}
+
+JitFunction jit_lookup(Deserialized* module, int32_t ipc) {
+  return NULL;
+}
+
+#endif
@@ -3,41 +3,14 @@
 #include <core/library.h>
 #include <deserializer.h>
 #include <interpreter.h>
+#include <jit.h>
+#include <passes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <limits.h>
 #include <gc.h>
 
-char* GetDirname(char* path);
-
-#if defined(_WIN32)
-  #include <direct.h>
-  #define GetCurrentDir _getcwd
-  #define PATH_SEP '\\'
-
-  #include <shlwapi.h>
-  #pragma comment(lib, "shlwapi.lib")
-
-  char* GetDirname(char* path) {
-    char* dir = GC_strdup(path);
-    PathRemoveFileSpec(dir);
-    return dir;
-  }
-#else
-  #include <sys/stat.h>
-  #include <unistd.h>
-  #include <libgen.h>
-  #define GetCurrentDir getcwd
-  #define PATH_SEP '/'
-
-  char* GetDirname(char* path) {
-    char* dir = GC_strdup(path);
-    char* dname = dirname(dir);
-    return dname;
-  }
-#endif
-
 enum { BigEndian, LittleEndian };
 
 int endianness(void) {
@@ -49,38 +22,26 @@ int endianness(void) {
   return (u.b[0] == 0x01) ? BigEndian : LittleEndian;
 }
 
-struct Env {
-  char* path;
-  int32_t path_len;
-  uint8_t res;
-};
-
-static inline struct Env get_std_path() {
-  struct Env env;
-  env.path = getenv("PLUME_PATH");
-  env.path_len = env.path == NULL ? 0 : strlen(env.path);
-  env.res = env.path == NULL;
-  return env;
-}
-
-static inline struct Env get_mod_path() {
-  struct Env env;
-  env.path = getenv("PPM_PATH");
-  env.path_len = env.path == NULL ? 0 : strlen(env.path);
-  env.res = env.path == NULL;
-  return env;
-}
-
 int main(int argc, char** argv) {
 #if DEBUG
   unsigned long long start = clock_gettime_nsec_np(CLOCK_MONOTONIC);
 #endif
   GC_init();
+  init_values();
 
   Stack* st = stack_new();
 
-  if (argc < 2) THROW_FMT("Usage: %s <file>\n", argv[0]);
-  FILE* file = fopen(argv[1], "rb");
+  // Optimization flags come before the file, and are hidden from the
+  // program.
+  int first = 1;
+  while (first < argc && parse_optimization_flag(argv[first])) first++;
+
+  if (first >= argc) THROW_FMT("Usage: %s [options] <file>\n", argv[0]);
+  FILE* file = fopen(argv[first], "rb");
+
+  argv[first - 1] = argv[0];
+  argv += first - 1;
+  argc -= first - 1;
 
   Value* values = GC_malloc(sizeof(Value) * argc);
   for (int i = 0; i < argc; i++) {
@@ -91,7 +52,6 @@ int main(int argc, char** argv) {
 
   char* filename = GC_strdup(argv[1]);
   char* dir = GetDirname(filename);
-  size_t len = strlen(dir);
 
   int endianness_check = endianness();
 
@@ -105,49 +65,10 @@ int main(int argc, char** argv) {
 
   des.argc = argc;
   des.argv = values;
-  des.handles = GC_malloc(des.libraries.num_libraries * sizeof(void*));
+  load_libraries(&des, dir);
 
-  struct Env res = get_std_path();
-  struct Env mod = get_mod_path();
-
-  // TODO: Implement library loading in a flat manner
-  //       in order to avoid `calloc` calls in the loop.
-  Libraries libs = des.libraries;
-
-  for (int i = 0; i < des.libraries.num_libraries; i++) {
-    Library lib = libs.libraries[i];
-    char* path = lib.name;
-
-    if (lib.is_standard == 1 && res.res != 0) {
-      THROW("Standard library path not found");
-    }
-
-    if (lib.is_standard == 2 && mod.res != 0) {
-      THROW("PPM_PATH not found in environment");
-    }
-
-    int final_len = lib.is_standard == 1 
-      ? res.path_len 
-      : lib.is_standard == 2
-        ? mod.path_len + 9
-        : len; 
-
-    char* final_path =
-        GC_malloc(final_len + strlen(path) + 2);
-
-    if (lib.is_standard == 1 && res.res == 0) {
-      sprintf(final_path, "%s%c%s", res.path, PATH_SEP, path);
-    } else if (lib.is_standard == 2 && mod.res == 0) {
-      sprintf(final_path, "%s%c%s%c%s", mod.path, PATH_SEP, "modules", PATH_SEP, path);
-    } else {
-      sprintf(final_path, "%s%c%s", dir, PATH_SEP, path);
-    }
-
-    des.handles[i] = load_library(final_path);
-
-    des.natives[i].functions =
-        GC_malloc(lib.num_functions * sizeof(Native));
-  }
+  // Natives are linked while translating, so libraries must be loaded first.
+  translate_bytecode(&des);
 
 #if DEBUG
   DEBUG_PRINTLN("Instruction count: %d", des.instr_count);
@@ -160,12 +81,21 @@ int main(int argc, char** argv) {
   unsigned long long start_interp = clock_gettime_nsec_np(CLOCK_MONOTONIC);
 #endif
 
-  run_interpreter(&des, 0, false, 0);
+  run_interpreter(&des, 0);
+
+  if (optimizations.report_memoization) memo_report(des.memo, stderr);
+  if (des.profile != NULL) profile_write(des.profile, optimizations.write_profile);
 
   stack_free(st);
   GC_free(values);
   // free(des.constants.constants);
   free(des.instrs);
+  free(des.code);
+  free(des.opcodes);
+  free(des.functions);
+  free(des.stack_depths);
+  jit_free(des.jit);
+  profile_free(des.profile);
 
 
 #if DEBUG
@@ -173,6 +103,14 @@ int main(int argc, char** argv) {
 
   unsigned long long interp_time = (end_interp - start_interp) / 1000 / 1000;
   DEBUG_PRINTLN("Interpretation took %lld ms", interp_time);
+
+  // Dispatch cost benchmark: average time spent per executed instruction.
+  double ns_per_op = (double) (end_interp - start_interp) / executed_instructions;
+  DEBUG_PRINTLN("Executed %llu instructions, %.2f ns per instruction",
+                (unsigned long long) executed_instructions, ns_per_op);
+  print_opcode_pairs(10);
+  print_call_cache_stats(&des);
 #endif
+  free(des.call_caches);
   return 0;
 }
@@ -0,0 +1,177 @@
+#include <core/error.h>
+#include <gc.h>
+#include <memo.h>
+#include <string.h>
+
+Memo* memo_new(int32_t code_length, int32_t capacity) {
+  Memo* memo = GC_malloc(sizeof(Memo));
+
+  // Slots are found by masking the hash.
+  int32_t size = 1;
+  while (size < capacity) size *= 2;
+
+  memo->tables = GC_malloc((code_length + 1) * sizeof(MemoTable*));
+  memo->code_length = code_length;
+  memo->capacity = size;
+  return memo;
+}
+
+void memo_add(Memo* memo, int32_t entry) {
+  MemoTable* table = GC_malloc(sizeof(MemoTable));
+  table->argc = -1;
+  table->capacity = memo->capacity;
+
+  memo->tables[entry] = table;
+}
+
+static uint64_t mix(uint64_t hash, uint64_t value) {
+  hash = (hash ^ value) * 0x9E3779B97F4A7C15ULL;
+  return hash ^ (hash >> 32);
+}
+
+static uint64_t hash_value(Value value, int32_t* budget) {
+  if (!IS_PTR(value)) return value;
+
+  HeapValue* heap = GET_PTR(value);
+
+  switch (heap->type) {
+    case TYPE_STRING: {
+      uint64_t hash = heap->length;
+      for (uint32_t i = 0; i < heap->length && i < MEMO_HASH_LIMIT; i++) {
+        hash = mix(hash, (uint8_t) heap->as_string[i]);
+      }
+      return hash;
+    }
+    case TYPE_LIST: {
+      uint64_t hash = heap->length;
+      for (uint32_t i = 0; i < heap->length && *budget > 0; i++) {
+        (*budget)--;
+        hash = mix(hash, hash_value(heap->as_ptr[i], budget));
+      }
+      return hash;
+    }
+    case TYPE_INT64:
+      return (uint64_t) heap->as_int64;
+
+    // Other heap values are compared by identity.
+    default:
+      return value;
+  }
+}
+
+static bool same_value(Value x, Value y) {
+  if (x == y) return true;
+  if (!IS_PTR(x) || !IS_PTR(y)) return false;
+
+  HeapValue* a = GET_PTR(x);
+  HeapValue* b = GET_PTR(y);
+  if (a->type != b->type) return false;
+
+  switch (a->type) {
+    case TYPE_STRING:
+      return strcmp(a->as_string, b->as_string) == 0;
+    case TYPE_LIST:
+      if (a->length != b->length) return false;
+
+      for (uint32_t i = 0; i < a->length; i++) {
+        if (!same_value(a->as_ptr[i], b->as_ptr[i])) return false;
+      }
+      return true;
+    case TYPE_INT64:
+      return a->as_int64 == b->as_int64;
+    default:
+      return false;
+  }
+}
+
+uint64_t memo_hash(Value* args, int32_t argc) {
+  uint64_t hash = argc;
+
+  for (int32_t i = 0; i < argc; i++) {
+    int32_t budget = MEMO_HASH_LIMIT;
+    hash = mix(hash, hash_value(args[i], &budget));
+  }
+
+  return hash != 0 ? hash : 1;
+}
+
+static void disable(MemoTable* table) {
+  table->disabled = true;
+  table->hashes = NULL;
+  table->arguments = NULL;
+  table->results = NULL;
+  table->used = 0;
+}
+
+bool memo_lookup(MemoTable* table, Value* args, int32_t argc, uint64_t hash, Value* result) {
+  if (table->argc < 0) {
+    table->argc = argc;
+    table->hashes = GC_malloc_atomic(table->capacity * sizeof(uint64_t));
+    table->arguments = GC_malloc((size_t) table->capacity * argc * sizeof(Value));
+    table->results = GC_malloc(table->capacity * sizeof(Value));
+
+    memset(table->hashes, 0, table->capacity * sizeof(uint64_t));
+  }
+
+  ASSERT_FMT(argc == table->argc, "Memoized function called with %d arguments instead of %d", argc, table->argc);
+
+  int32_t slot = hash & (table->capacity - 1);
+  bool found = table->hashes[slot] == hash;
+
+  for (int32_t i = 0; found && i < argc; i++) {
+    found = same_value(table->arguments[slot * argc + i], args[i]);
+  }
+
+  if (found) {
+    *result = table->results[slot];
+    table->hits++;
+  } else {
+    table->misses++;
+  }
+
+  if (table->hits + table->misses == MEMO_PROBATION && table->hits < MEMO_MIN_HITS) disable(table);
+  return found;
+}
+
+void memo_store(MemoTable* table, Value* args, int32_t argc, uint64_t hash, Value result) {
+  // The table may have been disabled by the calls made meanwhile.
+  if (table->disabled) return;
+
+  int32_t slot = hash & (table->capacity - 1);
+  if (table->hashes[slot] == 0) table->used++;
+
+  table->hashes[slot] = hash;
+  table->results[slot] = result;
+  memcpy(&table->arguments[slot * argc], args, argc * sizeof(Value));
+}
+
+static size_t table_size(MemoTable* table) {
+  if (table->hashes == NULL) return sizeof(MemoTable);
+  return sizeof(MemoTable) + table->capacity * (sizeof(uint64_t) + (table->argc + 1) * sizeof(Value));
+}
+
+void memo_report(Memo* memo, FILE* out) {
+  if (memo == NULL) return;
+
+  int64_t hits = 0, lookups = 0;
+  size_t size = 0;
+
+  for (int32_t i = 0; i < memo->code_length; i++) {
+    MemoTable* table = memo->tables[i];
+    if (table == NULL || table->hits + table->misses == 0) continue;
+
+    int64_t calls = table->hits + table->misses;
+    fprintf(out, "Memoized function at %d: %lld calls, %.1f%% hits, %d/%d entries, %zu bytes%s\n", i,
+            (long long) calls, 100.0 * table->hits / calls, table->used, table->capacity,
+            table_size(table), table->disabled ? " (disabled)" : "");
+
+    hits += table->hits;
+    lookups += calls;
+    size += table_size(table);
+  }
+
+  if (lookups > 0) {
+    fprintf(out, "Memoization: %lld calls, %.1f%% hits, %zu bytes\n", (long long) lookups,
+            100.0 * hits / lookups, size);
+  }
+}
@@ -1,15 +1,102 @@
+#include <core/error.h>
+#include <gc.h>
 #include <module.h>
+#include <stdio.h>
+#include <string.h>
 
-Frame pop_frame(Deserialized *mod) {
-  Value clos_env = mod->stack->values[mod->base_pointer];
+#if defined(_WIN32)
+  #include <direct.h>
+  #define GetCurrentDir _getcwd
+  #define PATH_SEP '\\'
 
-  ASSERT_FMT(get_type(clos_env) == TYPE_FUNCENV, "Expected closure environment got %s", type_of(clos_env));
+  #include <shlwapi.h>
+  #pragma comment(lib, "shlwapi.lib")
 
-  reg pc = (int16_t) GET_NTH_ELEMENT(clos_env, 0);
-  size_t old_sp = (int16_t) GET_NTH_ELEMENT(clos_env, 1);
-  size_t base_ptr = (int16_t) GET_NTH_ELEMENT(clos_env, 2);
+  char* GetDirname(char* path) {
+    char* dir = GC_strdup(path);
+    PathRemoveFileSpec(dir);
+    return dir;
+  }
+#else
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #include <libgen.h>
+  #define GetCurrentDir getcwd
+  #define PATH_SEP '/'
 
-  mod->call_stack.frame_pointer--;
+  char* GetDirname(char* path) {
+    char* dir = GC_strdup(path);
+    char* dname = dirname(dir);
+    return dname;
+  }
+#endif
 
-  return (Frame) { pc, old_sp, base_ptr };
-}
\ No newline at end of file
+struct Env {
+  char* path;
+  int32_t path_len;
+  uint8_t res;
+};
+
+static inline struct Env get_std_path() {
+  struct Env env;
+  env.path = getenv("PLUME_PATH");
+  env.path_len = env.path == NULL ? 0 : strlen(env.path);
+  env.res = env.path == NULL;
+  return env;
+}
+
+static inline struct Env get_mod_path() {
+  struct Env env;
+  env.path = getenv("PPM_PATH");
+  env.path_len = env.path == NULL ? 0 : strlen(env.path);
+  env.res = env.path == NULL;
+  return env;
+}
+
+void load_libraries(Deserialized *des, char *dir) {
+  size_t len = strlen(dir);
+
+  des->handles = GC_malloc(des->libraries.num_libraries * sizeof(void*));
+
+  struct Env res = get_std_path();
+  struct Env mod = get_mod_path();
+
+  // TODO: Implement library loading in a flat manner
+  //       in order to avoid `calloc` calls in the loop.
+  Libraries libs = des->libraries;
+
+  for (int i = 0; i < des->libraries.num_libraries; i++) {
+    Library lib = libs.libraries[i];
+    char* path = lib.name;
+
+    if (lib.is_standard == 1 && res.res != 0) {
+      THROW("Standard library path not found");
+    }
+
+    if (lib.is_standard == 2 && mod.res != 0) {
+      THROW("PPM_PATH not found in environment");
+    }
+
+    int final_len = lib.is_standard == 1 
+      ? res.path_len 
+      : lib.is_standard == 2
+        ? mod.path_len + 9
+        : len;
+
+    char* final_path =
+        GC_malloc(final_len + strlen(path) + 2);
+
+    if (lib.is_standard == 1 && res.res == 0) {
+      sprintf(final_path, "%s%c%s", res.path, PATH_SEP, path);
+    } else if (lib.is_standard == 2 && mod.res == 0) {
+      sprintf(final_path, "%s%c%s%c%s", mod.path, PATH_SEP, "modules", PATH_SEP, path);
+    } else {
+      sprintf(final_path, "%s%c%s", dir, PATH_SEP, path);
+    }
+
+    des->handles[i] = load_library(final_path);
+
+    des->natives[i].functions =
+        GC_malloc(lib.num_functions * sizeof(Native));
+  }
+}
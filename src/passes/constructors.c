@@ -0,0 +1,49 @@
+#include <bytecode.h>
+#include <passes.h>
+#include <stdlib.h>
+
+// Matches on constructors load the name of a value and compare it with a
+// string constant:
+//
+//   ListGet k; LoadConstant "Ctor"; Compare ==
+//   ListGet k; JumpElseRelCmpConst(else, "Ctor")
+//
+// The name is replaced by its tag, and the constant by the tag of the
+// interned string, which compare as integers. Names that are not strings
+// are rejected by ConstructorTag as they were by the comparison.
+
+static bool string_constant(Deserialized* module, int32_t constant, int32_t* tag) {
+  Value value = module->constants.constants[constant];
+  if (get_type(value) != TYPE_STRING) return false;
+
+  *tag = GET_PTR(value)->tag;
+  return *tag != 0;
+}
+
+void tag_constructors(Deserialized* module, Bytecode* bytecode) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  bool* targets = find_jump_targets(bytecode);
+
+  for (int32_t i = 0; i + 1 < count; i++) {
+    if (instrs[i].opcode != OP_ListGet || targets[i + 1]) continue;
+
+    Instruction* next = &instrs[i + 1];
+    int32_t tag;
+
+    if (next->opcode == OP_JumpElseRelCmpConst && string_constant(module, next->operand3, &tag)) {
+      int32_t constant = find_constant(module, MAKE_INTEGER(tag));
+      *next = (Instruction) { OP_IJumpElseRelCmpConst, next->operand1, EqualTo, constant, 0 };
+    } else if (next->opcode == OP_LoadConstant && i + 2 < count && !targets[i + 2]
+               && instrs[i + 2].opcode == OP_Compare && instrs[i + 2].operand1 == KindEqualTo
+               && string_constant(module, next->operand1, &tag)) {
+      next->operand1 = find_constant(module, MAKE_INTEGER(tag));
+    } else {
+      continue;
+    }
+
+    instrs[i].opcode = OP_ConstructorTag;
+  }
+
+  free(targets);
+}
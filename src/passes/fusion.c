@@ -0,0 +1,81 @@
+#include <bytecode.h>
+#include <passes.h>
+#include <stdlib.h>
+
+typedef struct {
+  Opcode sequence[3];
+  int32_t length;
+  Opcode fused;
+} Superinstruction;
+
+// Sequences picked from opcode pair statistics (see the DEBUG dispatch
+// counters in the interpreter). Longer sequences come first so that the
+// widest match wins.
+static const Superinstruction superinstructions[] = {
+  { { OP_LoadLocal, OP_LoadLocal, OP_Add }, 3, OP_AddLocals },
+  { { OP_LoadLocal, OP_LoadLocal, OP_Sub }, 3, OP_SubLocals },
+  { { OP_LoadLocal, OP_LoadLocal, OP_Mul }, 3, OP_MulLocals },
+  { { OP_LoadLocal, OP_AddConst, OP_StoreLocal }, 3, OP_AddConstLocal },
+  { { OP_LoadLocal, OP_SubConst, OP_StoreLocal }, 3, OP_SubConstLocal },
+  { { OP_LoadLocal, OP_LoadLocal }, 2, OP_LoadLocal2 },
+  { { OP_LoadLocal, OP_AddConst }, 2, OP_LoadLocalAddConst },
+  { { OP_LoadLocal, OP_SubConst }, 2, OP_LoadLocalSubConst },
+  { { OP_LoadLocal, OP_ListGet }, 2, OP_LoadLocalListGet },
+};
+
+#define SUPERINSTRUCTION_COUNT \
+  (sizeof(superinstructions) / sizeof(Superinstruction))
+
+static bool matches(Bytecode* bytecode, bool* targets, int32_t idx,
+                    const Superinstruction* super) {
+  if (idx + super->length > bytecode->instruction_count) return false;
+
+  for (int32_t i = 0; i < super->length; i++) {
+    if (bytecode->instructions[idx + i].opcode != super->sequence[i]) return false;
+
+    // Control flow must not enter the middle of a fused sequence.
+    if (i > 0 && targets[idx + i]) return false;
+  }
+
+  return true;
+}
+
+static Instruction fuse(Instruction* seq, Opcode fused) {
+  switch (fused) {
+    case OP_AddConstLocal: case OP_SubConstLocal:
+      return (Instruction) { fused, seq[0].operand1, seq[2].operand1, seq[1].operand1, 0 };
+    case OP_LoadLocalAddConst: case OP_LoadLocalSubConst:
+      return (Instruction) { fused, seq[0].operand1, 0, seq[1].operand1, 0 };
+    default:
+      return (Instruction) { fused, seq[0].operand1, seq[1].operand1, 0, 0 };
+  }
+}
+
+// The fused instruction replaces the first instruction of the sequence, and
+// its handler skips over the remaining ones. Those are left in place so that
+// relative jump offsets stay valid.
+void fuse_superinstructions(Bytecode* bytecode) {
+  bool* targets = find_jump_targets(bytecode);
+
+  int32_t i = 0;
+  while (i < bytecode->instruction_count) {
+    const Superinstruction* match = NULL;
+
+    for (size_t j = 0; j < SUPERINSTRUCTION_COUNT; j++) {
+      if (matches(bytecode, targets, i, &superinstructions[j])) {
+        match = &superinstructions[j];
+        break;
+      }
+    }
+
+    if (match == NULL) {
+      i++;
+      continue;
+    }
+
+    bytecode->instructions[i] = fuse(&bytecode->instructions[i], match->fused);
+    i += match->length;
+  }
+
+  free(targets);
+}
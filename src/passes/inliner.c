@@ -0,0 +1,279 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <passes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Splices the bodies of small leaf functions into the functions calling them
+// through the global they are stored in. The callee's locals take new slots
+// below the caller's own, which the caller's frame reserves: every existing
+// slot of the caller moves down, keeping the arguments it receives at the
+// bottom of its frame (see push_frame).
+
+typedef struct {
+  Bytecode* bytecode;
+  int32_t* owners;
+
+  // Header defining each global, or -1 when the global is not a known
+  // function.
+  int32_t* definitions;
+
+  // Whether the function defined by each header can be inlined, and the
+  // number of call sites it was inlined at.
+  bool* inlinable;
+  int32_t* inlined_calls;
+
+  // Slots added to the frame of each function, indexed by entry.
+  int32_t* extra_locals;
+} Inliner;
+
+static int32_t body_end(Instruction* instrs, int32_t header) {
+  return jump_target(instrs, header);
+}
+
+static int32_t header_local_space(Instruction* header) {
+  return header->opcode == OP_MakeLambda ? header->operand2 : header->operand3;
+}
+
+// Leaf functions only, without nested lambdas, and returning with nothing
+// else on their operand stack, so that the returned value is left where the
+// call would have pushed it.
+static bool can_inline(Inliner* in, int32_t header, int32_t threshold) {
+  Instruction* instrs = in->bytecode->instructions;
+  int32_t entry = header + 1;
+  int32_t end = body_end(instrs, header);
+
+  if (end - entry > threshold) return false;
+
+  for (int32_t i = entry; i < end; i++) {
+    switch (instrs[i].opcode) {
+      case OP_Call:
+        if (instrs[i - 1].opcode != OP_LoadNative) return false;
+        break;
+      case OP_CallGlobal: case OP_CallLocal: case OP_MakeLambda:
+      case OP_MakeAndStoreLambda: case OP_Halt: case OP_ReturnUnit:
+        return false;
+      default:
+        break;
+    }
+  }
+
+  int32_t count = end - entry;
+  int32_t* depths = malloc(count * sizeof(int32_t));
+  int32_t* worklist = malloc(count * sizeof(int32_t));
+  int32_t pending = 0;
+  bool inlinable = true;
+
+  for (int32_t i = 0; i < count; i++) depths[i] = -1;
+
+  depths[0] = 0;
+  worklist[pending++] = entry;
+
+  // Depths are consistent across paths, as the bytecode was verified.
+  while (pending > 0 && inlinable) {
+    int32_t i = worklist[--pending];
+    int32_t depth = depths[i - entry];
+
+    if (instrs[i].opcode == OP_Return) inlinable = depth == 1;
+    if (instrs[i].opcode == OP_ReturnConst) inlinable = depth == 0;
+
+    int32_t next_depth = depth + stack_effect(instrs, i);
+    int32_t successors[] = { falls_through(&instrs[i]) ? i + 1 : -1, jump_target(instrs, i) };
+
+    for (int32_t k = 0; k < 2; k++) {
+      int32_t next = successors[k];
+      if (next < 0 || depths[next - entry] >= 0) continue;
+
+      depths[next - entry] = next_depth;
+      worklist[pending++] = next;
+    }
+  }
+
+  free(depths);
+  free(worklist);
+  return inlinable;
+}
+
+// Header of the function inlined at a call site, or -1.
+static int32_t inlined_callee(Inliner* in, int32_t idx) {
+  Instruction call = in->bytecode->instructions[idx];
+  if (call.opcode != OP_CallGlobal || in->owners[idx] == 0) return -1;
+
+  int32_t header = in->definitions[call.operand1];
+  if (header < 0 || !in->inlinable[header]) return -1;
+
+  // Extra arguments would be dropped by the frame.
+  Instruction* def = &in->bytecode->instructions[header];
+  if (call.operand2 > header_local_space(def)) return -1;
+
+  return header;
+}
+
+// Number of instructions replacing a call: the arguments are stored into
+// the callee's slots, and each return jumps past the body.
+static int32_t inlined_size(Inliner* in, int32_t idx, int32_t header) {
+  Instruction* instrs = in->bytecode->instructions;
+  int32_t size = instrs[idx].operand2;
+
+  for (int32_t i = header + 1; i < body_end(instrs, header); i++) {
+    size += instrs[i].opcode == OP_ReturnConst ? 2 : 1;
+  }
+
+  return size;
+}
+
+// Writes the inlined body of the callee at `header`, starting at `base`.
+// Jump targets are recorded as absolute positions in `targets`.
+static void emit_inlined(Inliner* in, int32_t idx, int32_t header, Instruction* out,
+                         int32_t* targets, int32_t base, int32_t end) {
+  Instruction* instrs = in->bytecode->instructions;
+  int32_t entry = header + 1;
+  int32_t count = body_end(instrs, header) - entry;
+  int32_t local_space = header_local_space(&instrs[header]);
+  int32_t argc = instrs[idx].operand2;
+
+  // Arguments were pushed in order, the last one on top.
+  int32_t at = base;
+  for (int32_t k = argc - 1; k >= 0; k--) {
+    targets[at] = -1;
+    out[at++] = (Instruction) { OP_StoreLocal, -local_space + k, 0, 0, 0 };
+  }
+
+  int32_t* positions = malloc(count * sizeof(int32_t));
+  for (int32_t i = 0, p = at; i < count; i++) {
+    positions[i] = p;
+    p += instrs[entry + i].opcode == OP_ReturnConst ? 2 : 1;
+  }
+
+  for (int32_t i = entry; i < entry + count; i++) {
+    Instruction instr = instrs[i];
+    int32_t target = jump_target(instrs, i);
+
+    switch (instr.opcode) {
+      case OP_Return:
+        targets[at] = end;
+        out[at++] = (Instruction) { OP_JumpRel, 0, 0, 0, 0 };
+        break;
+      case OP_ReturnConst:
+        targets[at] = -1;
+        out[at++] = (Instruction) { OP_LoadConstant, instr.operand1, 0, 0, 0 };
+        targets[at] = end;
+        out[at++] = (Instruction) { OP_JumpRel, 0, 0, 0, 0 };
+        break;
+      default:
+        targets[at] = target >= 0 ? positions[target - entry] : -1;
+        out[at++] = instr;
+        break;
+    }
+  }
+
+  free(positions);
+}
+
+static bool uses_slot(Opcode opcode) {
+  return opcode == OP_LoadLocal || opcode == OP_StoreLocal || opcode == OP_CallLocal;
+}
+
+static void report(Inliner* in) {
+  Instruction* instrs = in->bytecode->instructions;
+
+  for (int32_t i = 0; i < in->bytecode->instruction_count; i++) {
+    if (instrs[i].opcode != OP_MakeAndStoreLambda) continue;
+
+    int32_t size = body_end(instrs, i) - i - 1;
+    if (in->inlined_calls[i] > 0) {
+      fprintf(stderr, "Inlined function %d (global %d, %d instructions) at %d call sites\n",
+              i + 1, instrs[i].operand1, size, in->inlined_calls[i]);
+    } else if (in->inlinable[i]) {
+      fprintf(stderr, "Function %d (global %d, %d instructions) is never called directly\n",
+              i + 1, instrs[i].operand1, size);
+    }
+  }
+}
+
+void inline_functions(Bytecode* bytecode, int32_t threshold, bool verbose) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+
+  Inliner in;
+  in.bytecode = bytecode;
+  in.owners = malloc((count + 1) * sizeof(int32_t));
+  in.definitions = malloc(GLOBALS_SIZE * sizeof(int32_t));
+  in.inlinable = calloc(count + 1, sizeof(bool));
+  in.inlined_calls = calloc(count + 1, sizeof(int32_t));
+  in.extra_locals = calloc(count + 1, sizeof(int32_t));
+
+  find_owners(bytecode, in.owners);
+  find_definitions(bytecode, in.owners, in.definitions);
+
+  for (int32_t g = 0; g < GLOBALS_SIZE; g++) {
+    int32_t header = in.definitions[g];
+    if (header >= 0) in.inlinable[header] = can_inline(&in, header, threshold);
+  }
+
+  // Inlined bodies never overlap, so a caller reserves the slots of its
+  // largest callee only.
+  int32_t* positions = malloc((count + 1) * sizeof(int32_t));
+  int32_t length = 0;
+
+  for (int32_t i = 0; i < count; i++) {
+    positions[i] = length;
+
+    int32_t header = inlined_callee(&in, i);
+    if (header < 0) {
+      length++;
+      continue;
+    }
+
+    int32_t* extra = &in.extra_locals[in.owners[i]];
+    int32_t local_space = header_local_space(&instrs[header]);
+    if (local_space > *extra) *extra = local_space;
+
+    in.inlined_calls[header]++;
+    length += inlined_size(&in, i, header);
+  }
+  positions[count] = length;
+
+  if (verbose) report(&in);
+
+  if (length == count) goto done;
+
+  Instruction* out = malloc(length * sizeof(Instruction));
+  int32_t* targets = malloc(length * sizeof(int32_t));
+
+  for (int32_t i = 0; i < count; i++) {
+    int32_t header = inlined_callee(&in, i);
+    if (header >= 0) {
+      emit_inlined(&in, i, header, out, targets, positions[i], positions[i + 1]);
+      continue;
+    }
+
+    Instruction instr = instrs[i];
+    int32_t target = jump_target(instrs, i);
+
+    if (uses_slot(instr.opcode)) instr.operand1 -= in.extra_locals[in.owners[i]];
+
+    if (instr.opcode == OP_MakeLambda) instr.operand2 += in.extra_locals[i + 1];
+    if (instr.opcode == OP_MakeAndStoreLambda) instr.operand3 += in.extra_locals[i + 1];
+
+    out[positions[i]] = instr;
+    targets[positions[i]] = target >= 0 ? positions[target] : -1;
+  }
+
+  for (int32_t i = 0; i < length; i++) {
+    if (targets[i] >= 0) set_jump_target(out, i, targets[i]);
+  }
+
+  free(bytecode->instructions);
+  bytecode->instructions = out;
+  bytecode->instruction_count = length;
+  free(targets);
+
+done:
+  free(positions);
+  free(in.owners);
+  free(in.definitions);
+  free(in.inlinable);
+  free(in.inlined_calls);
+  free(in.extra_locals);
+}
@@ -0,0 +1,96 @@
+#include <bytecode.h>
+#include <core/debug.h>
+#include <passes.h>
+#include <stdlib.h>
+
+// Orders the code of a profiled program so that hot code is contiguous.
+// Instructions are moved in chains: maximal sequences in which each one falls
+// through to the next, so that no jumps have to be added. Jumps, function
+// entries and jumps over lambda bodies are resolved at layout.
+
+typedef struct {
+  int32_t start;
+  int32_t end;
+  int32_t function;
+  uint64_t weight;
+  uint64_t function_weight;
+} Chain;
+
+// Hot functions come first, each with its entry chain followed by its other
+// hot chains from the hottest. Ties keep the original order.
+static int compare_chains(const void* a, const void* b) {
+  const Chain* x = a;
+  const Chain* y = b;
+
+  if (x->function_weight != y->function_weight) return x->function_weight > y->function_weight ? -1 : 1;
+  if (x->function != y->function) return x->function < y->function ? -1 : 1;
+
+  bool x_entry = x->start == x->function;
+  bool y_entry = y->start == y->function;
+  if (x_entry != y_entry) return x_entry ? -1 : 1;
+
+  if (x->weight != y->weight) return x->weight > y->weight ? -1 : 1;
+  return x->start < y->start ? -1 : 1;
+}
+
+static int32_t append_chain(Bytecode* bytecode, Chain* chain, int32_t* order, int32_t ordered) {
+  for (int32_t i = chain->start; i < chain->end; i += instruction_size(&bytecode->instructions[i])) {
+    order[ordered++] = i;
+  }
+  return ordered;
+}
+
+int32_t order_instructions(Bytecode* bytecode, uint64_t* counts, int32_t* order) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  int32_t starts = 0;
+
+  if (counts == NULL || count == 0) {
+    for (int32_t i = 0; i < count; i += instruction_size(&instrs[i])) order[starts++] = i;
+    return starts;
+  }
+
+  int32_t* owners = malloc((count + 1) * sizeof(int32_t));
+  Chain* chains = malloc((count + 1) * sizeof(Chain));
+  int32_t chain_count = 0;
+
+  find_owners(bytecode, owners);
+
+  for (int32_t i = 0; i < count; i += instruction_size(&instrs[i])) {
+    if (i == 0 || !falls_through(&instrs[order[starts - 1]])) {
+      int32_t function = owners[i];
+      chains[chain_count++] = (Chain) { i, i, function, 0, counts[function] };
+    }
+
+    Chain* chain = &chains[chain_count - 1];
+    if (counts[i] > chain->weight) chain->weight = counts[i];
+    chain->end = i + instruction_size(&instrs[i]);
+
+    order[starts++] = i;
+  }
+
+  // The top level starts at the first code word, so its first chain stays
+  // there. Cold chains keep their order after the hot ones.
+  Chain* hot = malloc((chain_count + 1) * sizeof(Chain));
+  int32_t hot_count = 0;
+
+  for (int32_t c = 1; c < chain_count; c++) {
+    if (chains[c].weight > 0) hot[hot_count++] = chains[c];
+  }
+  qsort(hot, hot_count, sizeof(Chain), compare_chains);
+
+  int32_t ordered = append_chain(bytecode, &chains[0], order, 0);
+
+  for (int32_t c = 0; c < hot_count; c++) ordered = append_chain(bytecode, &hot[c], order, ordered);
+
+  for (int32_t c = 1; c < chain_count; c++) {
+    if (chains[c].weight == 0) ordered = append_chain(bytecode, &chains[c], order, ordered);
+  }
+
+  DEBUG_PRINTLN("Layout: %d of %d chains are hot", hot_count, chain_count - 1);
+
+  free(owners);
+  free(chains);
+  free(hot);
+  return starts;
+}
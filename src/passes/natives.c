@@ -0,0 +1,67 @@
+#include <bytecode.h>
+#include <core/library.h>
+#include <gc.h>
+#include <module.h>
+#include <passes.h>
+#include <stdlib.h>
+
+static Native resolve_native(Deserialized* module, Instruction* load) {
+  int32_t name_idx = load->operand1;
+  int32_t lib = load->operand2;
+  int32_t fn = load->operand3;
+
+  if (name_idx < 0 || name_idx >= module->constants.constant_count) return NULL;
+  if (lib < 0 || lib >= module->libraries.num_libraries) return NULL;
+  if (fn < 0 || fn >= module->libraries.libraries[lib].num_functions) return NULL;
+
+  Value name = module->constants.constants[name_idx];
+  if (get_type(name) != TYPE_STRING || module->handles[lib] == NULL) return NULL;
+
+  Native nfun = module->natives[lib].functions[fn];
+  if (nfun == NULL) {
+    nfun = get_proc_address(module->handles[lib], GET_NATIVE(name));
+    module->natives[lib].functions[fn] = nfun;
+  }
+
+  return nfun;
+}
+
+// Binds every `LoadNative` directly followed by a `Call` to its function
+// pointer, and rewrites the pair into a single `CallNative` carrying the
+// index of the function in the linked table. Natives that cannot be
+// resolved are left alone, so that the error is still reported when (and
+// if) they are called.
+void link_natives(Deserialized* module, Bytecode* bytecode) {
+  Libraries libs = module->libraries;
+
+  module->library_offsets = GC_malloc((libs.num_libraries + 1) * sizeof(int32_t));
+  module->library_offsets[0] = 0;
+  for (int32_t i = 0; i < libs.num_libraries; i++) {
+    module->library_offsets[i + 1] =
+        module->library_offsets[i] + libs.libraries[i].num_functions;
+  }
+
+  module->linked_natives =
+      GC_malloc(module->library_offsets[libs.num_libraries] * sizeof(Native));
+
+  bool* targets = find_jump_targets(bytecode);
+
+  for (int32_t i = 0; i + 1 < bytecode->instruction_count; i++) {
+    Instruction* load = &bytecode->instructions[i];
+    Instruction* call = &bytecode->instructions[i + 1];
+
+    if (load->opcode != OP_LoadNative || call->opcode != OP_Call) continue;
+    if (targets[i + 1]) continue;
+
+    Native nfun = resolve_native(module, load);
+    if (nfun == NULL) continue;
+
+    int32_t idx = module->library_offsets[load->operand2] + load->operand3;
+    module->linked_natives[idx] = nfun;
+
+    *load = (Instruction) { OP_CallNative, idx, call->operand1, 0, 0 };
+    i++;
+  }
+
+  free(targets);
+}
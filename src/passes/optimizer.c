@@ -0,0 +1,454 @@
+#include <bytecode.h>
+#include <core/debug.h>
+#include <core/error.h>
+#include <gc.h>
+#include <interpreter.h>
+#include <memo.h>
+#include <passes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Load-time optimizations over verified stack bytecode. Passes rewrite
+// instructions in place and mark the ones they make useless as removed.
+// Removed instructions are dropped at the end, and jumps remapped to the
+// instructions that remain.
+
+#define INLINE_THRESHOLD 12
+
+Optimizations optimizations = { true, true, true, true, true, true, true, true, INLINE_THRESHOLD, false, MEMO_SIZE, false, NULL, NULL };
+
+static const struct {
+  const char* name;
+  bool* enabled;
+} optimization_flags[] = {
+  { "inline", &optimizations.inline_functions },
+  { "constructor-tags", &optimizations.tag_constructors },
+  { "switches", &optimizations.build_switches },
+  { "fold-constants", &optimizations.fold_constants },
+  { "thread-jumps", &optimizations.thread_jumps },
+  { "remove-unreachable", &optimizations.remove_unreachable },
+  { "remove-redundant-locals", &optimizations.remove_redundant_locals },
+  { "memoize", &optimizations.memoize },
+};
+
+#define OPTIMIZATION_FLAG_COUNT \
+  (sizeof(optimization_flags) / sizeof(optimization_flags[0]))
+
+typedef struct {
+  Deserialized* module;
+  Bytecode* bytecode;
+  bool* removed;
+  bool* targets;
+
+  int32_t folded;
+  int32_t threaded;
+  int32_t unreachable;
+  int32_t redundant;
+} Optimizer;
+
+bool parse_optimization_flag(const char* arg) {
+  if (strncmp(arg, "--inline-threshold=", 19) == 0) {
+    optimizations.inline_threshold = atoi(arg + 19);
+    return true;
+  }
+
+  if (strcmp(arg, "--report-inlining") == 0) {
+    optimizations.report_inlining = true;
+    return true;
+  }
+
+  if (strncmp(arg, "--memo-size=", 12) == 0) {
+    optimizations.memo_size = atoi(arg + 12);
+    return true;
+  }
+
+  if (strcmp(arg, "--report-memoization") == 0) {
+    optimizations.report_memoization = true;
+    return true;
+  }
+
+  if (strncmp(arg, "--write-profile=", 16) == 0) {
+    optimizations.write_profile = arg + 16;
+    return true;
+  }
+
+  if (strncmp(arg, "--use-profile=", 14) == 0) {
+    optimizations.use_profile = arg + 14;
+    return true;
+  }
+
+  if (strncmp(arg, "--no-", 5) != 0) return false;
+
+  for (size_t i = 0; i < OPTIMIZATION_FLAG_COUNT; i++) {
+    if (strcmp(arg + 5, optimization_flags[i].name) == 0) {
+      *optimization_flags[i].enabled = false;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// First instruction at or after `idx` that has not been removed.
+static int32_t next_live(Optimizer* o, int32_t idx) {
+  while (idx < o->bytecode->instruction_count && o->removed[idx]) idx++;
+  return idx;
+}
+
+static bool is_jump(Opcode opcode) {
+  switch (opcode) {
+    case OP_JumpRel: case OP_JumpElseRel: case OP_JumpElseRelCmp:
+    case OP_IJumpElseRelCmp: case OP_JumpElseRelCmpConst:
+    case OP_IJumpElseRelCmpConst: case OP_Switch: case OP_SwitchSparse:
+    case OP_SwitchCase:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool int_constant(Optimizer* o, int32_t constant, uint32_t* value) {
+  Value v = o->module->constants.constants[constant];
+  if (!IS_INT(v)) return false;
+
+  *value = GET_INT(v);
+  return true;
+}
+
+// Whether the live instruction after `idx` can be folded with it: it exists,
+// and control flow does not enter it from elsewhere.
+static int32_t foldable_next(Optimizer* o, int32_t idx) {
+  int32_t next = next_live(o, idx + 1);
+  if (next >= o->bytecode->instruction_count || o->targets[next]) return -1;
+  return next;
+}
+
+// Returns the index of `value` in the constant pool, adding it if needed.
+int32_t find_constant(Deserialized* module, Value value) {
+  Constants* constants = &module->constants;
+
+  for (int32_t i = 0; i < constants->constant_count; i++) {
+    if (constants->constants[i] == value) return i;
+  }
+
+  Value* grown = GC_malloc((constants->constant_count + 1) * sizeof(Value));
+  memcpy(grown, constants->constants, constants->constant_count * sizeof(Value));
+  grown[constants->constant_count] = value;
+
+  constants->constants = grown;
+  return constants->constant_count++;
+}
+
+// Results that overflow are boxed at runtime, and are left unfolded.
+static bool fold_integer(Opcode opcode, int32_t x, int32_t y, Value* result) {
+  int32_t r;
+  bool overflows;
+
+  switch (opcode) {
+    case OP_Add: overflows = __builtin_add_overflow(x, y, &r); break;
+    case OP_Sub: overflows = __builtin_sub_overflow(x, y, &r); break;
+    default: overflows = __builtin_mul_overflow(x, y, &r); break;
+  }
+
+  *result = MAKE_INTEGER(r);
+  return !overflows;
+}
+
+// Integers `b` and `a` are pushed right before the instruction, `a` on top
+// of the stack.
+static bool fold_binary(Instruction* instr, uint32_t b, uint32_t a, Value* result) {
+  switch (instr->opcode) {
+    case OP_Add: case OP_Sub: case OP_Mul:
+      return fold_integer(instr->opcode, (int32_t) b, (int32_t) a, result);
+    case OP_Compare:
+      *result = comparison_table[instr->operand1](MAKE_INTEGER(b), MAKE_INTEGER(a));
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Same for conditional jumps, which jump when the condition is false.
+static bool fold_condition(Instruction* instr, uint32_t b, uint32_t a, bool* jumps) {
+  switch (instr->opcode) {
+    case OP_JumpElseRelCmp:
+      *jumps = GET_INT(comparison_table[instr->operand2](MAKE_INTEGER(a), MAKE_INTEGER(b))) == 0;
+      return true;
+    case OP_IJumpElseRelCmp:
+      switch (instr->operand1) {
+        case KindEqualTo: *jumps = a != b; return true;
+        case KindAnd: *jumps = (a & b) == 0; return true;
+        case KindOr: *jumps = (a | b) == 0; return true;
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+// Conditions on a single pushed integer.
+static bool fold_unary_condition(Optimizer* o, Instruction* instr, uint32_t a, bool* jumps) {
+  uint32_t b;
+
+  switch (instr->opcode) {
+    case OP_JumpElseRel:
+      *jumps = a == 0;
+      return true;
+    case OP_JumpElseRelCmpConst:
+      if (!int_constant(o, instr->operand3, &b)) return false;
+      *jumps = a != b;
+      return true;
+    case OP_IJumpElseRelCmpConst: {
+      if (!int_constant(o, instr->operand3, &b)) return false;
+
+      int32_t x = (int32_t) a, y = (int32_t) b;
+      uint32_t results[] = { x < y, x > y, a == b, a != b, x <= y, x >= y, a & b, a | b };
+      *jumps = results[instr->operand2] == 0;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+static bool fold_arithmetic_constant(Optimizer* o, Instruction* instr, uint32_t a, Value* result) {
+  uint32_t b;
+
+  switch (instr->opcode) {
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      // Verified to be an integer.
+      if (!int_constant(o, instr->operand1, &b)) return false;
+      break;
+    default:
+      return false;
+  }
+
+  Opcode opcode = instr->opcode == OP_AddConst ? OP_Add : instr->opcode == OP_SubConst ? OP_Sub : OP_Mul;
+  return fold_integer(opcode, (int32_t) a, (int32_t) b, result);
+}
+
+// Replaces the folded sequence from `first` to `last` by the outcome of its
+// conditional jump: an unconditional jump, or nothing.
+static void fold_jump(Optimizer* o, int32_t first, int32_t last, bool jumps) {
+  Instruction* instrs = o->bytecode->instructions;
+
+  for (int32_t i = first; i <= last; i++) o->removed[i] = true;
+
+  if (jumps) {
+    int32_t target = jump_target(instrs, last);
+    instrs[first] = (Instruction) { OP_JumpRel, 0, 0, 0, 0 };
+    set_jump_target(instrs, first, target);
+    o->removed[first] = false;
+  }
+}
+
+// Folds integer constants pushed by LoadConstant into the arithmetic,
+// comparisons and conditional jumps consuming them. Folded results are
+// pushed by the first LoadConstant, so folding repeats until nothing
+// changes.
+static void fold_constants(Optimizer* o) {
+  Instruction* instrs = o->bytecode->instructions;
+  bool changed = true;
+
+  while (changed) {
+    changed = false;
+
+    for (int32_t i = 0; i < o->bytecode->instruction_count; i++) {
+      uint32_t a, b;
+      Value result;
+      bool jumps;
+
+      if (o->removed[i] || instrs[i].opcode != OP_LoadConstant) continue;
+      if (!int_constant(o, instrs[i].operand1, &b)) continue;
+
+      int32_t j = foldable_next(o, i);
+      if (j < 0) continue;
+
+      if (fold_arithmetic_constant(o, &instrs[j], b, &result)) {
+        instrs[i].operand1 = find_constant(o->module, result);
+        o->removed[j] = true;
+      } else if (fold_unary_condition(o, &instrs[j], b, &jumps)) {
+        fold_jump(o, i, j, jumps);
+      } else if (instrs[j].opcode == OP_LoadConstant && int_constant(o, instrs[j].operand1, &a)) {
+        int32_t k = foldable_next(o, j);
+        if (k < 0) continue;
+
+        if (fold_binary(&instrs[k], b, a, &result)) {
+          instrs[i].operand1 = find_constant(o->module, result);
+          o->removed[j] = o->removed[k] = true;
+        } else if (fold_condition(&instrs[k], b, a, &jumps)) {
+          fold_jump(o, i, k, jumps);
+        } else {
+          continue;
+        }
+      } else {
+        continue;
+      }
+
+      o->folded++;
+      changed = true;
+    }
+  }
+}
+
+// Retargets jumps landing on an unconditional jump to its final target, and
+// removes unconditional jumps to the next instruction.
+static void thread_jumps(Optimizer* o) {
+  Instruction* instrs = o->bytecode->instructions;
+  int32_t count = o->bytecode->instruction_count;
+
+  for (int32_t i = 0; i < count; i++) {
+    if (o->removed[i] || !is_jump(instrs[i].opcode)) continue;
+
+    int32_t target = next_live(o, jump_target(instrs, i));
+
+    // Bounded, as jumps may form an infinite loop.
+    for (int32_t hops = 0; hops < count && target < count && instrs[target].opcode == OP_JumpRel; hops++) {
+      target = next_live(o, jump_target(instrs, target));
+    }
+
+    if (target != jump_target(instrs, i)) {
+      set_jump_target(instrs, i, target);
+      o->threaded++;
+    }
+
+    if (instrs[i].opcode == OP_JumpRel && target == next_live(o, i + 1)) {
+      o->removed[i] = true;
+      o->threaded++;
+    }
+  }
+}
+
+// Removes the instructions that cannot be reached from the entry point, nor
+// from the entry of a lambda whose creation can be reached.
+static void remove_unreachable(Optimizer* o) {
+  Instruction* instrs = o->bytecode->instructions;
+  int32_t count = o->bytecode->instruction_count;
+
+  bool* reached = calloc(count + 1, sizeof(bool));
+  int32_t* worklist = malloc((count + 1) * sizeof(int32_t));
+  int32_t pending = 0;
+
+  int32_t entry = next_live(o, 0);
+  reached[entry] = true;
+  worklist[pending++] = entry;
+
+  while (pending > 0) {
+    int32_t i = worklist[--pending];
+    if (i >= count) continue;
+
+    Opcode opcode = instrs[i].opcode;
+    bool creates_lambda = opcode == OP_MakeLambda || opcode == OP_MakeAndStoreLambda;
+
+    int32_t successors[] = {
+      falls_through(&instrs[i]) || creates_lambda ? next_live(o, i + 1) : -1,
+      jump_target(instrs, i) >= 0 ? next_live(o, jump_target(instrs, i)) : -1,
+    };
+
+    for (int32_t k = 0; k < 2; k++) {
+      int32_t next = successors[k];
+      if (next < 0 || reached[next]) continue;
+
+      reached[next] = true;
+      worklist[pending++] = next;
+    }
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    if (o->removed[i] || reached[i]) continue;
+
+    o->removed[i] = true;
+    o->unreachable++;
+  }
+
+  free(reached);
+  free(worklist);
+}
+
+static void remove_redundant_locals_in(Optimizer* o, int32_t entry, int32_t local_space, int32_t* owners) {
+  Instruction* instrs = o->bytecode->instructions;
+  int32_t count = o->bytecode->instruction_count;
+  int32_t* reads = calloc(local_space + 1, sizeof(int32_t));
+
+  // Locals are only read by the function owning them.
+  for (int32_t i = entry; i < count; i++) {
+    if (o->removed[i] || owners[i] != entry) continue;
+
+    if (instrs[i].opcode == OP_LoadLocal || instrs[i].opcode == OP_CallLocal)
+      reads[-instrs[i].operand1]++;
+  }
+
+  for (int32_t i = entry; i < count; i++) {
+    if (o->removed[i] || owners[i] != entry) continue;
+
+    Opcode opcode = instrs[i].opcode;
+    if (opcode != OP_LoadLocal && opcode != OP_StoreLocal) continue;
+
+    int32_t j = foldable_next(o, i);
+    if (j < 0 || instrs[j].operand1 != instrs[i].operand1) continue;
+
+    // A local stored back where it was loaded from, or a store whose value
+    // is only read right after: the value stays on the stack instead.
+    bool reload = opcode == OP_LoadLocal && instrs[j].opcode == OP_StoreLocal;
+    bool single_read = opcode == OP_StoreLocal && instrs[j].opcode == OP_LoadLocal
+                       && reads[-instrs[i].operand1] == 1;
+
+    if (reload || single_read) {
+      o->removed[i] = o->removed[j] = true;
+      o->redundant++;
+    }
+  }
+
+  free(reads);
+}
+
+// Frame slots of the top level alias the globals (see BASE_POINTER), so
+// only lambda bodies are considered.
+static void remove_redundant_locals(Optimizer* o) {
+  Instruction* instrs = o->bytecode->instructions;
+  int32_t count = o->bytecode->instruction_count;
+  int32_t* owners = malloc((count + 1) * sizeof(int32_t));
+
+  find_owners(o->bytecode, owners);
+
+  for (int32_t i = 0; i < count; i++) {
+    if (o->removed[i]) continue;
+
+    if (instrs[i].opcode == OP_MakeLambda) {
+      remove_redundant_locals_in(o, i + 1, instrs[i].operand2, owners);
+    } else if (instrs[i].opcode == OP_MakeAndStoreLambda) {
+      remove_redundant_locals_in(o, i + 1, instrs[i].operand3, owners);
+    }
+  }
+
+  free(owners);
+}
+
+void optimize_bytecode(Deserialized* module, Bytecode* bytecode) {
+  // Inlining comes first, so that the other passes clean up after it.
+  if (optimizations.inline_functions)
+    inline_functions(bytecode, optimizations.inline_threshold, optimizations.report_inlining);
+
+  // Before removing unreachable code, which takes the chains switches
+  // replace. Matches on constructors become integer tests first.
+  if (optimizations.tag_constructors) tag_constructors(module, bytecode);
+  if (optimizations.build_switches) build_switches(module, bytecode);
+
+  int32_t count = bytecode->instruction_count;
+  if (count == 0) return;
+
+  Optimizer o = { module, bytecode, calloc(count + 1, sizeof(bool)), find_jump_targets(bytecode), 0, 0, 0, 0 };
+
+  if (optimizations.fold_constants) fold_constants(&o);
+  if (optimizations.thread_jumps) thread_jumps(&o);
+  if (optimizations.remove_unreachable) remove_unreachable(&o);
+  if (optimizations.remove_redundant_locals) remove_redundant_locals(&o);
+
+  remove_instructions(bytecode, o.removed);
+
+  DEBUG_PRINTLN("Optimizer: %d folded, %d jumps threaded, %d unreachable, %d redundant locals, %d -> %d instructions",
+                o.folded, o.threaded, o.unreachable, o.redundant, count, bytecode->instruction_count);
+
+  free(o.removed);
+  free(o.targets);
+}
@@ -0,0 +1,86 @@
+#include <bytecode.h>
+#include <core/debug.h>
+#include <passes.h>
+#include <stdlib.h>
+#include <value.h>
+
+// Pure functions return a result that only depends on their arguments, so
+// that calls with equal arguments can share it (see memo.h). Their bodies
+// neither read nor write mutable cells or globals other than the ones
+// defining functions, and only call pure functions through those globals.
+// Instructions of nested lambdas belong to their own function.
+
+// Whether the instruction may observe or change state outside of its frame,
+// not counting calls through globals.
+static bool has_effects(Instruction* instr, int32_t* definitions) {
+  switch (instr->opcode) {
+    case OP_LoadGlobal:
+      return definitions[instr->operand1] < 0;
+    case OP_StoreGlobal: case OP_MakeAndStoreLambda: case OP_Update:
+    case OP_MakeMutable: case OP_UnMut: case OP_LoadNative: case OP_Call:
+    case OP_CallLocal: case OP_CallNative: case OP_TailCall:
+    case OP_TailCallLocal: case OP_Halt:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool* find_pure_functions(Bytecode* bytecode) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+
+  int32_t* owners = malloc((count + 1) * sizeof(int32_t));
+  int32_t* definitions = malloc(GLOBALS_SIZE * sizeof(int32_t));
+  bool* pure = calloc(count + 1, sizeof(bool));
+
+  find_owners(bytecode, owners);
+  find_definitions(bytecode, owners, definitions);
+
+  for (int32_t i = 0; i < count; i++) {
+    Opcode opcode = instrs[i].opcode;
+    if (opcode == OP_MakeLambda || opcode == OP_MakeAndStoreLambda) pure[i + 1] = true;
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    if (owners[i] != 0 && has_effects(&instrs[i], definitions)) pure[owners[i]] = false;
+  }
+
+  // Functions are assumed pure until they call an impure one, so that
+  // recursive functions can be pure.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+
+    for (int32_t i = 0; i < count; i++) {
+      Opcode opcode = instrs[i].opcode;
+      if (owners[i] == 0 || !pure[owners[i]]) continue;
+      if (opcode != OP_CallGlobal && opcode != OP_TailCallGlobal) continue;
+
+      int32_t header = definitions[instrs[i].operand1];
+      if (header >= 0 && pure[header + 1]) continue;
+
+      pure[owners[i]] = false;
+      changed = true;
+    }
+  }
+
+  // Later passes move instructions, but keep the order of headers.
+  bool* functions = calloc(count + 1, sizeof(bool));
+  int32_t function_count = 0, found = 0;
+
+  for (int32_t i = 0; i < count; i++) {
+    Opcode opcode = instrs[i].opcode;
+    if (opcode != OP_MakeLambda && opcode != OP_MakeAndStoreLambda) continue;
+
+    functions[function_count++] = pure[i + 1];
+    found += pure[i + 1];
+  }
+
+  DEBUG_PRINTLN("Purity: %d of %d functions are pure", found, function_count);
+
+  free(owners);
+  free(definitions);
+  free(pure);
+  return functions;
+}
@@ -0,0 +1,356 @@
+#include <bytecode.h>
+#include <passes.h>
+#include <stdlib.h>
+
+// Translation of stack bytecode into register form. Loads of locals and
+// constants are not executed where they appear: they are kept on a symbolic
+// operand stack, and become operands of the instruction consuming them,
+// which then reads the frame slot directly. Results are written to the slot
+// the stack machine would have pushed them to, or straight into a local when
+// they are stored right away.
+//
+// Instructions without a register form are kept unchanged. The loads still
+// pending are emitted before them, so that the real operand stack is in the
+// state they expect.
+
+typedef enum {
+  ENTRY_TEMPORARY,
+  ENTRY_LOCAL,
+  ENTRY_CONSTANT,
+} EntryKind;
+
+typedef struct {
+  EntryKind kind;
+  int32_t operand;
+} Entry;
+
+typedef struct {
+  Instruction* instrs;
+
+  Instruction* output;
+  int32_t output_count;
+
+  // Target of each emitted jump, as an index into the input, or -1.
+  int32_t* targets;
+
+  // Symbolic operand stack. Entries below `pending` are on the real stack,
+  // the ones above are loads that have not been emitted yet.
+  Entry* stack;
+  int32_t depth;
+  int32_t pending;
+
+  // Last emitted instruction if it pushed a result that may be redirected
+  // to a local, or -1.
+  int32_t last_result;
+} Translator;
+
+static int32_t emit(Translator* t, Instruction instr, int32_t target) {
+  t->output[t->output_count] = instr;
+  t->targets[t->output_count] = target;
+  t->last_result = -1;
+
+  return t->output_count++;
+}
+
+// Emits the pending loads below `depth`.
+static void flush(Translator* t, int32_t depth) {
+  for (; t->pending < depth; t->pending++) {
+    Entry* entry = &t->stack[t->pending];
+    Opcode opcode = entry->kind == ENTRY_LOCAL ? OP_LoadLocal : OP_LoadConstant;
+
+    emit(t, (Instruction) { opcode, entry->operand, 0, 0, 0 }, -1);
+    entry->kind = ENTRY_TEMPORARY;
+  }
+}
+
+static void reset(Translator* t, int32_t depth) {
+  for (int32_t i = 0; i < depth; i++) t->stack[i].kind = ENTRY_TEMPORARY;
+
+  t->depth = depth;
+  t->pending = depth;
+  t->last_result = -1;
+}
+
+static int32_t slot(Translator* t, int32_t position) {
+  Entry entry = t->stack[position];
+  return entry.kind == ENTRY_LOCAL ? entry.operand : position;
+}
+
+static bool is_kind(Translator* t, int32_t position, EntryKind kind) {
+  return t->stack[position].kind == kind;
+}
+
+static bool reads_local(Translator* t, int32_t depth, int32_t local) {
+  for (int32_t i = t->pending; i < depth; i++) {
+    if (is_kind(t, i, ENTRY_LOCAL) && t->stack[i].operand == local) return true;
+  }
+
+  return false;
+}
+
+// Emits an instruction writing its result to the slot of `position`, which
+// becomes the top of the operand stack.
+static void emit_result(Translator* t, int32_t position, Instruction instr, bool redirectable) {
+  int32_t idx = emit(t, instr, -1);
+
+  t->stack[position].kind = ENTRY_TEMPORARY;
+  t->depth = position + 1;
+  t->pending = t->depth;
+
+  if (redirectable) t->last_result = idx;
+}
+
+static void emit_unchanged(Translator* t, int32_t idx) {
+  Instruction* instrs = t->instrs;
+
+  flush(t, t->depth);
+
+  emit(t, instrs[idx], jump_target(instrs, idx));
+  for (int32_t i = 1; i < instruction_size(&instrs[idx]); i++) {
+    emit(t, instrs[idx + i], -1);
+  }
+
+  int32_t depth = t->depth + stack_effect(instrs, idx);
+  for (int32_t i = t->depth; i < depth; i++) t->stack[i].kind = ENTRY_TEMPORARY;
+
+  t->depth = depth;
+  t->pending = depth;
+}
+
+static void translate_store(Translator* t, int32_t local) {
+  int32_t top = t->depth - 1;
+  Entry entry = t->stack[top];
+
+  if (entry.kind == ENTRY_TEMPORARY) {
+    if (t->last_result >= 0 && t->output[t->last_result].operand1 == top) {
+      // The result goes straight to the local, and the operand stack is left
+      // as it was before the result was pushed.
+      t->output[t->last_result].operand1 = local;
+      t->output[t->last_result].operand2 = top;
+      t->last_result = -1;
+    } else {
+      emit(t, (Instruction) { OP_StoreLocal, local, 0, 0, 0 }, -1);
+    }
+
+    t->depth = top;
+    t->pending = top;
+    return;
+  }
+
+  // Pending loads must observe the value the local had before the store.
+  if (reads_local(t, top, local)) flush(t, top);
+
+  if (entry.kind == ENTRY_CONSTANT) {
+    emit(t, (Instruction) { OP_RLoadConstant, local, entry.operand, 0, 0 }, -1);
+  } else if (entry.operand != local) {
+    emit(t, (Instruction) { OP_RMove, local, entry.operand, 0, 0 }, -1);
+  }
+
+  t->depth = top;
+}
+
+static Opcode register_opcode(Opcode opcode) {
+  switch (opcode) {
+    case OP_Add: return OP_RAdd;
+    case OP_Sub: return OP_RSub;
+    case OP_Mul: return OP_RMul;
+    case OP_AddConst: return OP_RAddConst;
+    case OP_SubConst: return OP_RSubConst;
+    case OP_MulConst: return OP_RMulConst;
+    case OP_JumpElseRel: return OP_RJumpElseRel;
+    case OP_JumpElseRelCmp: return OP_RJumpElseRelCmp;
+    case OP_IJumpElseRelCmp: return OP_RIJumpElseRelCmp;
+    case OP_JumpElseRelCmpConst: return OP_RJumpElseRelCmpConst;
+    case OP_IJumpElseRelCmpConst: return OP_RIJumpElseRelCmpConst;
+    default: return opcode;
+  }
+}
+
+// Translates the instruction at `idx`, and returns false when it has no
+// register form in the current state.
+static bool translate_instruction(Translator* t, int32_t idx) {
+  Instruction instr = t->instrs[idx];
+  Opcode opcode = register_opcode(instr.opcode);
+  int32_t target = jump_target(t->instrs, idx);
+  int32_t top = t->depth - 1;
+
+  switch (instr.opcode) {
+    case OP_LoadLocal: case OP_LoadConstant: {
+      EntryKind kind = instr.opcode == OP_LoadLocal ? ENTRY_LOCAL : ENTRY_CONSTANT;
+      t->stack[t->depth++] = (Entry) { kind, instr.operand1 };
+      return true;
+    }
+
+    case OP_StoreLocal:
+      translate_store(t, instr.operand1);
+      return true;
+
+    case OP_Add: case OP_Sub: case OP_Mul: {
+      if (is_kind(t, top, ENTRY_CONSTANT) || is_kind(t, top - 1, ENTRY_CONSTANT)) return false;
+
+      flush(t, top - 1);
+      int32_t result = top - 1;
+      emit_result(t, top - 1, (Instruction) {
+        opcode, result, result + 1, slot(t, top - 1), slot(t, top)
+      }, true);
+      return true;
+    }
+
+    case OP_AddConst: case OP_SubConst: case OP_MulConst: {
+      if (is_kind(t, top, ENTRY_CONSTANT)) return false;
+
+      flush(t, top);
+      int32_t result = top;
+      emit_result(t, top, (Instruction) {
+        opcode, result, result + 1, slot(t, top), instr.operand1
+      }, true);
+      return true;
+    }
+
+    case OP_Compare: {
+      if (is_kind(t, top, ENTRY_CONSTANT) || is_kind(t, top - 1, ENTRY_CONSTANT)) return false;
+
+      flush(t, top - 1);
+      emit_result(t, top - 1, (Instruction) {
+        OP_RCompare, instr.operand1, top - 1, slot(t, top - 1), slot(t, top)
+      }, false);
+      return true;
+    }
+
+    // Conditional jumps only take locals: they do not move the stack pointer,
+    // so they cannot consume values from the real stack.
+    case OP_JumpElseRel: case OP_JumpElseRelCmpConst: {
+      if (!is_kind(t, top, ENTRY_LOCAL)) return false;
+
+      flush(t, top);
+      emit(t, (Instruction) { opcode, 0, slot(t, top), instr.operand3, 0 }, target);
+      t->depth = top;
+      return true;
+    }
+
+    case OP_IJumpElseRelCmpConst: {
+      if (!is_kind(t, top, ENTRY_LOCAL)) return false;
+
+      flush(t, top);
+      emit(t, (Instruction) {
+        opcode, 0, instr.operand2, slot(t, top), instr.operand3
+      }, target);
+      t->depth = top;
+      return true;
+    }
+
+    case OP_JumpElseRelCmp: case OP_IJumpElseRelCmp: {
+      if (!is_kind(t, top, ENTRY_LOCAL) || !is_kind(t, top - 1, ENTRY_LOCAL)) return false;
+
+      int32_t kind = instr.opcode == OP_JumpElseRelCmp ? instr.operand2 : instr.operand1;
+
+      flush(t, top - 1);
+      emit(t, (Instruction) {
+        opcode, 0, kind, slot(t, top), slot(t, top - 1)
+      }, target);
+      t->depth = top - 1;
+      return true;
+    }
+
+    // Returning discards the operand stack, so pending loads below the
+    // result are dropped.
+    case OP_Return: {
+      if (is_kind(t, top, ENTRY_LOCAL)) {
+        emit(t, (Instruction) { OP_RReturn, slot(t, top), 0, 0, 0 }, -1);
+      } else if (is_kind(t, top, ENTRY_CONSTANT)) {
+        emit(t, (Instruction) { OP_ReturnConst, t->stack[top].operand, 0, 0, 0 }, -1);
+      } else {
+        return false;
+      }
+
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+// Replaces the bytecode with its register form. `depths` holds the operand
+// stack depth on entry to each instruction (see compute_stack_depths), and
+// the function entries of `stack_depths` are moved to their new indices.
+void translate_registers(Bytecode* bytecode, int32_t* depths, int32_t** stack_depths) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  bool* jump_targets = find_jump_targets(bytecode);
+
+  // Every instruction is emitted at most once, either unchanged or folded
+  // into a register instruction.
+  Translator t;
+  t.instrs = instrs;
+  t.output = malloc((count + 1) * sizeof(Instruction));
+  t.output_count = 0;
+  t.targets = malloc((count + 1) * sizeof(int32_t));
+  t.stack = malloc((count * 3 + 3) * sizeof(Entry));
+  reset(&t, 0);
+
+  int32_t* map = malloc((count + 1) * sizeof(int32_t));
+  bool falls_into = false;
+
+  int32_t i = 0;
+  while (i < count) {
+    int32_t size = instruction_size(&instrs[i]);
+
+    if (depths[i] < 0) {
+      // Unreachable code is kept as it is.
+      map[i] = t.output_count;
+      for (int32_t j = 0; j < size; j++) {
+        map[i + j] = emit(&t, instrs[i + j], j == 0 ? jump_target(instrs, i) : -1);
+      }
+
+      falls_into = false;
+      i += size;
+      continue;
+    }
+
+    if (!falls_into) {
+      reset(&t, depths[i]);
+    } else if (jump_targets[i]) {
+      flush(&t, t.depth);
+      t.last_result = -1;
+    }
+
+    map[i] = t.output_count;
+    if (!translate_instruction(&t, i)) emit_unchanged(&t, i);
+
+    for (int32_t j = 1; j < size; j++) map[i + j] = map[i] + j;
+
+    falls_into = falls_through(&instrs[i]);
+    i += size;
+  }
+
+  map[count] = t.output_count;
+
+  for (int32_t j = 0; j < t.output_count; j++) {
+    if (t.targets[j] >= 0) set_jump_target(t.output, j, map[t.targets[j]]);
+  }
+
+  int32_t* old_depths = *stack_depths;
+  int32_t* new_depths = calloc(t.output_count + 1, sizeof(int32_t));
+
+  if (count > 0) new_depths[map[0]] = old_depths[0];
+
+  for (int32_t j = 0; j + 1 < count; j++) {
+    Opcode opcode = instrs[j].opcode;
+    if (opcode != OP_MakeLambda && opcode != OP_MakeAndStoreLambda) continue;
+
+    new_depths[map[j + 1]] = old_depths[j + 1];
+  }
+
+  free(old_depths);
+  *stack_depths = new_depths;
+
+  free(instrs);
+  bytecode->instructions = t.output;
+  bytecode->instruction_count = t.output_count;
+
+  free(t.targets);
+  free(t.stack);
+  free(map);
+  free(jump_targets);
+}
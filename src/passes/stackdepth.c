@@ -0,0 +1,91 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <passes.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Walks the control flow graph of the function starting at `entry` and
+// returns the maximum depth its operand stack can reach above the frame.
+static int32_t function_depth(Bytecode* bytecode, int32_t entry,
+                              int32_t* depths, int32_t* worklist,
+                              bool* queued) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+
+  // No well-formed function can push more than this, so a larger depth means
+  // that some loop keeps growing the stack.
+  int32_t limit = count * 3 + 3;
+
+  int32_t max_depth = 0;
+  int32_t pending = 0;
+
+  depths[entry] = 0;
+  worklist[pending++] = entry;
+  queued[entry] = true;
+
+  while (pending > 0) {
+    int32_t idx = worklist[--pending];
+    queued[idx] = false;
+
+    int32_t depth = depths[idx] + stack_effect(instrs, idx);
+    if (depth < 0) depth = 0;
+
+    ASSERT_FMT(depth <= limit, "Unbalanced operand stack at instruction %d", idx);
+    if (depth > max_depth) max_depth = depth;
+
+    int32_t successors[2] = {
+      jump_target(instrs, idx),
+      falls_through(&instrs[idx]) ? idx + instruction_size(&instrs[idx]) : -1,
+    };
+
+    for (int32_t i = 0; i < 2; i++) {
+      int32_t next = successors[i];
+      if (next < 0 || next >= count || depths[next] >= depth) continue;
+
+      depths[next] = depth;
+      if (!queued[next]) {
+        worklist[pending++] = next;
+        queued[next] = true;
+      }
+    }
+  }
+
+  return max_depth;
+}
+
+// Computes, for every function entry (the top-level entry and the
+// instruction after each lambda header), the maximum operand stack depth of
+// the function. Calls reserve that much stack once, so that the interpreter
+// can push without checking for overflow.
+//
+// When `instruction_depths` is not NULL, it receives the depth on entry to
+// every instruction, or -1 for unreachable ones.
+int32_t* compute_stack_depths(Bytecode* bytecode, int32_t* instruction_depths) {
+  int32_t count = bytecode->instruction_count;
+
+  int32_t* stack_depths = calloc(count + 1, sizeof(int32_t));
+  int32_t* depths = malloc((count + 1) * sizeof(int32_t));
+  int32_t* worklist = malloc((count + 1) * sizeof(int32_t));
+  bool* queued = calloc(count + 1, sizeof(bool));
+
+  for (int32_t i = 0; i < count; i++) depths[i] = -1;
+
+  if (count > 0) stack_depths[0] = function_depth(bytecode, 0, depths, worklist, queued);
+
+  for (int32_t i = 0; i < count; i++) {
+    Opcode opcode = bytecode->instructions[i].opcode;
+    if (opcode != OP_MakeLambda && opcode != OP_MakeAndStoreLambda) continue;
+    if (i + 1 >= count) continue;
+
+    stack_depths[i + 1] = function_depth(bytecode, i + 1, depths, worklist, queued);
+  }
+
+  if (instruction_depths != NULL)
+    memcpy(instruction_depths, depths, count * sizeof(int32_t));
+
+  free(depths);
+  free(worklist);
+  free(queued);
+
+  return stack_depths;
+}
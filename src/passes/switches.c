@@ -0,0 +1,228 @@
+#include <bytecode.h>
+#include <passes.h>
+#include <stdlib.h>
+
+// Recognizes chains of equality tests of the same value against integer
+// constants, as compiled for pattern matching:
+//
+//   LoadLocal x; IJumpElseRelCmpConst(next, ==, 0); <case 0>
+//   next: LoadLocal x; IJumpElseRelCmpConst(other, ==, 1); <case 1> ...
+//
+// The first test becomes a Switch over every key of the chain, whose default
+// is where the last test jumps to. The rest of the chain is left in place
+// for other jumps to it, and removed by the optimizer when unreachable.
+
+// Shorter chains are about as fast as a switch.
+#define SWITCH_MIN_CASES 3
+
+// Dense tables are used when at least half of their entries are cases.
+#define SWITCH_MAX_HOLES(cases) (cases)
+
+typedef struct {
+  uint32_t key;
+  int32_t target;
+} Case;
+
+typedef struct {
+  // Test replaced by the switch, and its cases in chain order.
+  int32_t test;
+  int32_t default_target;
+  Case* cases;
+  int32_t case_count;
+
+  bool dense;
+  uint32_t min;
+  int32_t entry_count;
+} Chain;
+
+// Length of the instructions loading the tested value at `idx`: a local or a
+// global, possibly indexed by a constant or replaced by its constructor tag.
+static int32_t scrutinee_length(Instruction* instrs, int32_t count, int32_t idx) {
+  Opcode opcode = instrs[idx].opcode;
+  if (opcode != OP_LoadLocal && opcode != OP_LoadGlobal) return 0;
+  if (idx + 1 == count) return 1;
+
+  Opcode next = instrs[idx + 1].opcode;
+  return next == OP_ListGet || next == OP_ConstructorTag ? 2 : 1;
+}
+
+static bool same_scrutinee(Instruction* instrs, int32_t a, int32_t b, int32_t length) {
+  for (int32_t i = 0; i < length; i++) {
+    if (instrs[a + i].opcode != instrs[b + i].opcode) return false;
+    if (instrs[a + i].operand1 != instrs[b + i].operand1) return false;
+  }
+
+  return true;
+}
+
+// Key of an equality test against an integer constant.
+static bool equality_key(Deserialized* module, Instruction* test, uint32_t* key) {
+  Value constant;
+
+  switch (test->opcode) {
+    case OP_IJumpElseRelCmpConst:
+      if (test->operand2 != EqualTo) return false;
+      constant = module->constants.constants[test->operand3];
+      break;
+    case OP_JumpElseRelCmpConst:
+      constant = module->constants.constants[test->operand3];
+      break;
+    default:
+      return false;
+  }
+
+  if (!IS_INT(constant)) return false;
+
+  *key = GET_INT(constant);
+  return true;
+}
+
+static int compare_cases(const void* a, const void* b) {
+  uint32_t x = ((const Case*) a)->key, y = ((const Case*) b)->key;
+  return (x > y) - (x < y);
+}
+
+// Follows the chain starting at `head`, marking its links in `linked`.
+// Returns false when it is too short.
+static bool find_chain(Deserialized* module, Bytecode* bytecode, bool* targets,
+                       bool* linked, int32_t head, Chain* chain) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+
+  int32_t length = scrutinee_length(instrs, count, head);
+  if (length == 0 || head + length >= count) return false;
+
+  // Control flow must enter the chain at its head.
+  for (int32_t i = 1; i <= length; i++) {
+    if (targets[head + i]) return false;
+  }
+
+  chain->test = head + length;
+  chain->cases = malloc(count * sizeof(Case));
+  chain->case_count = 0;
+
+  int32_t link = head;
+  while (true) {
+    int32_t test = link + length;
+    uint32_t key;
+
+    if (test >= count || !equality_key(module, &instrs[test], &key)) break;
+    linked[link] = true;
+
+    // Earlier tests of the same key shadow later ones.
+    bool shadowed = false;
+    for (int32_t k = 0; k < chain->case_count; k++) {
+      if (chain->cases[k].key == key) shadowed = true;
+    }
+
+    if (!shadowed) chain->cases[chain->case_count++] = (Case) { key, test + 1 };
+
+    // Chains only go forward, which also rules out cycles.
+    int32_t next = jump_target(instrs, test);
+    link = next;
+
+    if (next <= test || scrutinee_length(instrs, count, next) != length) break;
+    if (!same_scrutinee(instrs, head, next, length)) break;
+  }
+
+  chain->default_target = link;
+
+  if (chain->case_count < SWITCH_MIN_CASES) {
+    free(chain->cases);
+    return false;
+  }
+
+  qsort(chain->cases, chain->case_count, sizeof(Case), compare_cases);
+
+  uint32_t min = chain->cases[0].key;
+  uint32_t range = chain->cases[chain->case_count - 1].key - min + 1;
+
+  // Keys are distinct, so the range holds at least case_count keys.
+  uint32_t holes = range - (uint32_t) chain->case_count;
+  chain->dense = holes <= (uint32_t) SWITCH_MAX_HOLES(chain->case_count);
+  chain->min = min;
+  chain->entry_count = chain->dense ? (int32_t) range : chain->case_count;
+  return true;
+}
+
+static int32_t emit_switch(Chain* chain, Instruction* out, int32_t* targets, int32_t at,
+                           int32_t* positions) {
+  Opcode opcode = chain->dense ? OP_Switch : OP_SwitchSparse;
+
+  out[at] = (Instruction) { opcode, 0, chain->entry_count, (int32_t) chain->min, 0 };
+  targets[at++] = positions[chain->default_target];
+
+  for (int32_t k = 0, c = 0; k < chain->entry_count; k++) {
+    uint32_t key = chain->dense ? chain->min + k : chain->cases[k].key;
+    int32_t target = chain->default_target;
+
+    if (c < chain->case_count && chain->cases[c].key == key) target = chain->cases[c++].target;
+
+    out[at] = (Instruction) { OP_SwitchCase, 0, (int32_t) key, k + 1 < chain->entry_count, 0 };
+    targets[at++] = positions[target];
+  }
+
+  return at;
+}
+
+void build_switches(Deserialized* module, Bytecode* bytecode) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  bool* targets = find_jump_targets(bytecode);
+
+  // Chains indexed by the test they replace. The rest of a chain is not
+  // considered again.
+  Chain** chains = calloc(count + 1, sizeof(Chain*));
+  bool* linked = calloc(count + 1, sizeof(bool));
+  int32_t* positions = malloc((count + 1) * sizeof(int32_t));
+  int32_t length = 0;
+
+  for (int32_t i = 0; i < count; i++) {
+    Chain chain;
+    if (!linked[i] && find_chain(module, bytecode, targets, linked, i, &chain)) {
+      chains[chain.test] = malloc(sizeof(Chain));
+      *chains[chain.test] = chain;
+    }
+
+    positions[i] = length;
+    length += chains[i] != NULL ? 1 + chains[i]->entry_count : 1;
+  }
+  positions[count] = length;
+
+  if (length > count) {
+    Instruction* out = malloc(length * sizeof(Instruction));
+    int32_t* out_targets = malloc(length * sizeof(int32_t));
+
+    for (int32_t i = 0; i < count; i++) {
+      if (chains[i] != NULL) {
+        emit_switch(chains[i], out, out_targets, positions[i], positions);
+        continue;
+      }
+
+      int32_t target = jump_target(instrs, i);
+      out[positions[i]] = instrs[i];
+      out_targets[positions[i]] = target >= 0 ? positions[target] : -1;
+    }
+
+    for (int32_t i = 0; i < length; i++) {
+      if (out_targets[i] >= 0) set_jump_target(out, i, out_targets[i]);
+    }
+
+    free(instrs);
+    bytecode->instructions = out;
+    bytecode->instruction_count = length;
+    free(out_targets);
+  }
+
+  for (int32_t i = 0; i < count; i++) {
+    if (chains[i] == NULL) continue;
+
+    free(chains[i]->cases);
+    free(chains[i]);
+  }
+
+  free(chains);
+  free(linked);
+  free(positions);
+  free(targets);
+}
@@ -0,0 +1,26 @@
+#include <bytecode.h>
+#include <passes.h>
+
+// Rewrites calls that are directly followed by a return into tail calls.
+// The return is kept: it still runs when the callee turns out to be a
+// native, which cannot reuse the frame.
+void detect_tail_calls(Bytecode* bytecode) {
+  for (int32_t i = 0; i + 1 < bytecode->instruction_count; i++) {
+    Instruction* call = &bytecode->instructions[i];
+    if (bytecode->instructions[i + 1].opcode != OP_Return) continue;
+
+    switch (call->opcode) {
+      case OP_Call:
+        call->opcode = OP_TailCall;
+        break;
+      case OP_CallGlobal:
+        call->opcode = OP_TailCallGlobal;
+        break;
+      case OP_CallLocal:
+        call->opcode = OP_TailCallLocal;
+        break;
+      default:
+        break;
+    }
+  }
+}
@@ -0,0 +1,261 @@
+#include <bytecode.h>
+#include <core/error.h>
+#include <interpreter.h>
+#include <passes.h>
+#include <stdlib.h>
+
+// Load-time verification of serialized bytecode. Everything checked here is
+// relied upon by the interpreter without any further runtime check: jump
+// targets, constant and slot indices, comparison kinds, and operand stack
+// balance. Unreachable instructions are dropped rather than checked.
+
+typedef struct {
+  Deserialized* module;
+  Bytecode* bytecode;
+
+  // Function owning each instruction, identified by its entry.
+  int32_t* owners;
+  int32_t* depths;
+  int32_t* worklist;
+} Verifier;
+
+#define REJECT(idx, ...)                                     \
+  do {                                                       \
+    printf("Invalid bytecode at instruction %d: ", idx);     \
+    THROW_FMT(__VA_ARGS__);                                  \
+  } while (0)
+
+// Number of values the instruction pops before pushing its results.
+static int32_t stack_inputs(Instruction* instrs, int32_t idx) {
+  Instruction instr = instrs[idx];
+
+  switch (instr.opcode) {
+    case OP_StoreLocal: case OP_StoreGlobal: case OP_Return: case OP_ListGet:
+    case OP_JumpElseRel: case OP_TypeOf: case OP_Slice: case OP_ListLength:
+    case OP_MakeMutable: case OP_UnMut: case OP_AddConst: case OP_SubConst:
+    case OP_MulConst: case OP_JumpElseRelCmpConst: case OP_IJumpElseRelCmpConst:
+      return 1;
+    case OP_Compare: case OP_And: case OP_Or: case OP_GetIndex: case OP_Update:
+    case OP_Add: case OP_Sub: case OP_Mul: case OP_JumpElseRelCmp:
+    case OP_IJumpElseRelCmp:
+      return 2;
+    case OP_MakeList:
+      return instr.operand1;
+    case OP_Call:
+      return 1 - stack_effect(instrs, idx);
+    case OP_CallGlobal: case OP_CallLocal:
+      return instr.operand2;
+    default:
+      return 0;
+  }
+}
+
+static void check_constant(Verifier* v, int32_t idx, int32_t constant, ValueType type) {
+  Constants constants = v->module->constants;
+
+  if (constant < 0 || constant >= constants.constant_count)
+    REJECT(idx, "constant index %d out of bounds", constant);
+
+  if (type != TYPE_UNKNOWN && get_type(constants.constants[constant]) != type)
+    REJECT(idx, "constant %d has type %s", constant, type_of(constants.constants[constant]));
+}
+
+static void check_local(int32_t idx, int32_t slot, int32_t local_space) {
+  // Locals live right below the base pointer, at slots -local_space to -1.
+  if (slot >= 0 || slot < -local_space)
+    REJECT(idx, "local slot %d outside of frame of %d locals", slot, local_space);
+}
+
+static void check_global(int32_t idx, int32_t slot) {
+  if (slot < 0 || slot >= GLOBALS_SIZE)
+    REJECT(idx, "global slot %d out of bounds", slot);
+}
+
+static void check_operands(Verifier* v, int32_t idx, int32_t local_space, bool is_top_level) {
+  Instruction instr = v->bytecode->instructions[idx];
+
+  switch (instr.opcode) {
+    case OP_LoadLocal: case OP_StoreLocal:
+      check_local(idx, instr.operand1, local_space);
+      break;
+    case OP_CallLocal:
+      check_local(idx, instr.operand1, local_space);
+      if (instr.operand2 < 0) REJECT(idx, "negative argument count");
+      break;
+    case OP_LoadGlobal: case OP_StoreGlobal:
+      check_global(idx, instr.operand1);
+      break;
+    case OP_MakeAndStoreLambda:
+      check_global(idx, instr.operand1);
+      if (instr.operand3 < 0) REJECT(idx, "negative local space");
+      break;
+    case OP_CallGlobal:
+      check_global(idx, instr.operand1);
+      if (instr.operand2 < 0) REJECT(idx, "negative argument count");
+      break;
+    case OP_LoadConstant:
+      check_constant(v, idx, instr.operand1, TYPE_UNKNOWN);
+      break;
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      check_constant(v, idx, instr.operand1, TYPE_INTEGER);
+      break;
+    case OP_JumpElseRelCmpConst:
+      check_constant(v, idx, instr.operand3, TYPE_UNKNOWN);
+      break;
+    case OP_IJumpElseRelCmpConst:
+      check_constant(v, idx, instr.operand3, TYPE_INTEGER);
+      if (instr.operand2 < LessThan || instr.operand2 > Or)
+        REJECT(idx, "invalid comparison %d", instr.operand2);
+      break;
+    case OP_LoadNative: {
+      check_constant(v, idx, instr.operand1, TYPE_STRING);
+
+      Libraries libs = v->module->libraries;
+      if (instr.operand2 < 0 || instr.operand2 >= libs.num_libraries)
+        REJECT(idx, "library index %d out of bounds", instr.operand2);
+      if (instr.operand3 < 0 || instr.operand3 >= libs.libraries[instr.operand2].num_functions)
+        REJECT(idx, "native index %d out of bounds", instr.operand3);
+      break;
+    }
+    case OP_Compare:
+      if (!has_comparison(instr.operand1))
+        REJECT(idx, "unsupported comparison %d", instr.operand1);
+      break;
+    case OP_JumpElseRelCmp:
+      if (!has_comparison(instr.operand2))
+        REJECT(idx, "unsupported comparison %d", instr.operand2);
+      break;
+    case OP_IJumpElseRelCmp:
+      // Integer jumps only implement equality and the logical operators.
+      if (instr.operand1 != KindEqualTo && instr.operand1 != KindAnd && instr.operand1 != KindOr)
+        REJECT(idx, "unsupported comparison %d", instr.operand1);
+      break;
+    case OP_MakeList: case OP_ListGet: case OP_Slice: case OP_Call:
+      if (instr.operand1 < 0) REJECT(idx, "negative operand %d", instr.operand1);
+      break;
+    case OP_MakeLambda:
+      if (instr.operand2 < 0) REJECT(idx, "negative local space");
+      break;
+    case OP_ReturnConst:
+      check_constant(v, idx, instr.operand1, TYPE_UNKNOWN);
+      if (is_top_level) REJECT(idx, "return outside of a function");
+      break;
+    case OP_Return: case OP_ReturnUnit:
+      if (is_top_level) REJECT(idx, "return outside of a function");
+      break;
+    case OP_ConstructorName: case OP_Phi:
+      REJECT(idx, "unsupported opcode %d", instr.opcode);
+      break;
+    default:
+      break;
+  }
+}
+
+static void visit(Verifier* v, int32_t* pending, int32_t from, int32_t target,
+                  int32_t entry, int32_t depth) {
+  if (target < 0 || target >= v->bytecode->instruction_count || v->owners[target] != entry)
+    REJECT(from, "control flow to %d leaves the enclosing function", target);
+
+  if (v->depths[target] < 0) {
+    v->depths[target] = depth;
+    v->worklist[(*pending)++] = target;
+  } else if (v->depths[target] != depth) {
+    REJECT(target, "inconsistent stack depth (%d and %d)", v->depths[target], depth);
+  }
+}
+
+static void verify_function(Verifier* v, int32_t entry, int32_t local_space, bool is_top_level) {
+  Instruction* instrs = v->bytecode->instructions;
+  int32_t pending = 0;
+
+  if (v->owners[entry] != entry) return;
+
+  v->depths[entry] = 0;
+  v->worklist[pending++] = entry;
+
+  while (pending > 0) {
+    int32_t idx = v->worklist[--pending];
+    int32_t depth = v->depths[idx];
+
+    check_operands(v, idx, local_space, is_top_level);
+
+    if (stack_inputs(instrs, idx) > depth)
+      REJECT(idx, "operand stack underflow (depth %d)", depth);
+
+    int32_t next_depth = depth + stack_effect(instrs, idx);
+
+    int32_t target = jump_target(instrs, idx);
+    if (target >= 0) visit(v, &pending, idx, target, entry, next_depth);
+
+    if (falls_through(&instrs[idx]))
+      visit(v, &pending, idx, idx + 1, entry, next_depth);
+  }
+}
+
+// Assigns each instruction to its innermost function, and verifies that
+// lambda bodies are properly nested.
+static void assign_owners(Verifier* v, int32_t entry, int32_t end) {
+  Instruction* instrs = v->bytecode->instructions;
+
+  int32_t i = entry;
+  while (i < end) {
+    v->owners[i] = entry;
+
+    Opcode opcode = instrs[i].opcode;
+    if (opcode != OP_MakeLambda && opcode != OP_MakeAndStoreLambda) {
+      i++;
+      continue;
+    }
+
+    int32_t body_end = jump_target(instrs, i);
+    if (body_end <= i || body_end > end)
+      REJECT(i, "lambda body ends at %d, outside of the enclosing function", body_end);
+
+    assign_owners(v, i + 1, body_end);
+    i = body_end;
+  }
+}
+
+void verify_bytecode(Deserialized* module, Bytecode* bytecode) {
+  int32_t count = bytecode->instruction_count;
+
+  Verifier v;
+  v.module = module;
+  v.bytecode = bytecode;
+  v.owners = malloc((count + 1) * sizeof(int32_t));
+  v.depths = malloc((count + 1) * sizeof(int32_t));
+  v.worklist = malloc((count + 1) * sizeof(int32_t));
+
+  for (int32_t i = 0; i <= count; i++) {
+    v.owners[i] = -1;
+    v.depths[i] = -1;
+  }
+
+  assign_owners(&v, 0, count);
+
+  if (count > 0) verify_function(&v, 0, GLOBALS_SIZE, true);
+
+  for (int32_t i = 0; i < count; i++) {
+    Instruction instr = bytecode->instructions[i];
+
+    // Lambdas whose header is unreachable are never created.
+    if (v.depths[i] < 0) continue;
+
+    if (instr.opcode == OP_MakeLambda) {
+      verify_function(&v, i + 1, instr.operand2, false);
+    } else if (instr.opcode == OP_MakeAndStoreLambda) {
+      verify_function(&v, i + 1, instr.operand3, false);
+    }
+  }
+
+  // Instructions never reached were not checked, so later passes and the
+  // translation must not see them.
+  bool* removed = malloc((count + 1) * sizeof(bool));
+  for (int32_t i = 0; i < count; i++) removed[i] = v.depths[i] < 0;
+  remove_instructions(bytecode, removed);
+
+  free(removed);
+  free(v.owners);
+  free(v.depths);
+  free(v.worklist);
+}
@@ -0,0 +1,86 @@
+#include <core/error.h>
+#include <inttypes.h>
+#include <profile.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PROFILE_VERSION 1
+
+static uint64_t checksum(Bytecode* bytecode) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+
+  for (int32_t i = 0; i < bytecode->instruction_count; i++) {
+    Instruction* instr = &bytecode->instructions[i];
+    int32_t fields[] = { instr->opcode, instr->operand1, instr->operand2, instr->operand3, instr->operand4 };
+
+    for (size_t j = 0; j < sizeof(fields) / sizeof(fields[0]); j++) {
+      hash = (hash ^ (uint32_t) fields[j]) * 0x100000001B3ULL;
+    }
+  }
+
+  return hash;
+}
+
+Profile* profile_new(Bytecode* bytecode) {
+  Profile* profile = malloc(sizeof(Profile));
+  profile->counts = calloc(bytecode->instruction_count + 1, sizeof(uint64_t));
+  profile->instruction_count = bytecode->instruction_count;
+  profile->checksum = checksum(bytecode);
+  return profile;
+}
+
+Profile* profile_read(const char* path, Bytecode* bytecode) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Ignoring profile %s: could not open it\n", path);
+    return NULL;
+  }
+
+  Profile* profile = profile_new(bytecode);
+  int version, instruction_count;
+  uint64_t sum;
+
+  bool valid = fscanf(file, "plume-profile %d %d %" SCNx64, &version, &instruction_count, &sum) == 3 &&
+               version == PROFILE_VERSION && instruction_count == profile->instruction_count &&
+               sum == profile->checksum;
+
+  int32_t instr;
+  uint64_t count;
+
+  while (valid && fscanf(file, "%d %" SCNu64, &instr, &count) == 2) {
+    valid = instr >= 0 && instr < instruction_count;
+    if (valid) profile->counts[instr] = count;
+  }
+
+  valid = valid && feof(file);
+  fclose(file);
+
+  if (!valid) {
+    fprintf(stderr, "Ignoring profile %s: recorded for other bytecode\n", path);
+    profile_free(profile);
+    return NULL;
+  }
+
+  return profile;
+}
+
+void profile_write(Profile* profile, const char* path) {
+  FILE* file = fopen(path, "w");
+  if (file == NULL) THROW_FMT("Could not write profile: %s\n", path);
+
+  fprintf(file, "plume-profile %d %d %" PRIx64 "\n", PROFILE_VERSION, profile->instruction_count,
+          profile->checksum);
+
+  for (int32_t i = 0; i < profile->instruction_count; i++) {
+    if (profile->counts[i] > 0) fprintf(file, "%d %" PRIu64 "\n", i, profile->counts[i]);
+  }
+
+  fclose(file);
+}
+
+void profile_free(Profile* profile) {
+  if (profile == NULL) return;
+
+  free(profile->counts);
+  free(profile);
+}
@@ -19,8 +19,7 @@ void stack_free(Stack* stack) {
 }
 
 void stack_resize(Stack *st) {
-  st->capacity *= 2;
-  Value* new_st = realloc(st->values, st->capacity * sizeof(Value));
+  Value* new_st = realloc(st->values, st->capacity * 2 * sizeof(Value));
 
   if (new_st == NULL) {
     // Handle allocation failure
@@ -28,5 +27,16 @@ void stack_resize(Stack *st) {
     return;
   }
 
+  st->capacity *= 2;
   st->values = new_st;
 }
+
+// Grows the stack until `n` more values can be pushed without checking.
+void stack_reserve(Stack *st, int32_t n) {
+  while (DOES_OVERFLOW(st, n)) {
+    int32_t capacity = st->capacity;
+    stack_resize(st);
+
+    if (st->capacity == capacity) THROW("Stack overflow");
+  }
+}
@@ -5,6 +5,38 @@
 #include <value.h>
 #include <gc.h>
 
+Value unit_value;
+Value empty_list;
+Value type_names[VALUE_TYPE_COUNT];
+
+static HeapValue unit_name;
+static Value unit_fields[3];
+static HeapValue unit_heap;
+static HeapValue empty_list_heap;
+static HeapValue type_name_heaps[VALUE_TYPE_COUNT];
+
+static HeapValue static_string(char* string) {
+  return (HeapValue) { .type = TYPE_STRING, .length = strlen(string), .as_string = string };
+}
+
+void init_values(void) {
+  unit_name = static_string("unit");
+  unit_fields[0] = MAKE_SPECIAL();
+  unit_fields[1] = MAKE_PTR(&unit_name);
+  unit_fields[2] = MAKE_PTR(&unit_name);
+
+  unit_heap = (HeapValue) { .type = TYPE_LIST, .length = 3, .as_ptr = unit_fields };
+  unit_value = MAKE_PTR(&unit_heap);
+
+  empty_list_heap = (HeapValue) { .type = TYPE_LIST, .length = 0, .as_ptr = NULL };
+  empty_list = MAKE_PTR(&empty_list_heap);
+
+  for (int32_t type = 0; type < VALUE_TYPE_COUNT; type++) {
+    type_name_heaps[type] = static_string(type_name(type));
+    type_names[type] = MAKE_PTR(&type_name_heaps[type]);
+  }
+}
+
 char* constructor_name(Value v) {
   ASSERT(get_type(v) == TYPE_LIST,
          "Cannot get constructor name of non-list value");
@@ -21,6 +53,8 @@ char* constructor_name(Value v) {
 }
 
 Value equal(Value x, Value y) {
+  if (IS_INTEGER(x) && IS_INTEGER(y)) return MAKE_INTEGER(GET_INT64(x) == GET_INT64(y));
+
   ValueType x_type = get_type(x);
   ASSERT(x_type == get_type(y), "Cannot compare values of different types");
 
@@ -67,6 +101,9 @@ void native_print(Value value) {
     case TYPE_INTEGER:
       printf("%d", (int32_t)value);
       break;
+    case TYPE_INT64:
+      printf("%lld", (long long) GET_INT64(value));
+      break;
     case TYPE_SPECIAL:
       printf("<special>");
       break;
@@ -127,6 +164,45 @@ Value MAKE_LIST(Stack* gc, Value* x, uint32_t len) {
   return MAKE_PTR(v);
 }
 
+// Constructor values are never mutated, so their fields are allocated along
+// with their header.
+Value MAKE_CONSTRUCTOR(Stack* gc, Value* fields, uint32_t len) {
+  // Like allocate, which does not use the stack either, but sized for the
+  // fields.
+  (void) gc;
+  HeapValue* v = GC_malloc(sizeof(HeapValue) + len * sizeof(Value));
+
+  v->type = TYPE_LIST;
+  v->length = len;
+  v->as_ptr = (Value*) (v + 1);
+
+  memcpy(v->as_ptr, fields, len * sizeof(Value));
+  return MAKE_PTR(v);
+}
+
+Value MAKE_CLOSURE(Stack* gc, Value* items, int32_t entry, int32_t local_space) {
+  (void) gc;
+  Closure* c = GC_malloc(sizeof(Closure));
+
+  c->header.type = TYPE_LIST;
+  c->header.length = 2;
+  c->header.tag = CLOSURE_TAG;
+  c->header.as_ptr = c->values;
+  c->entry = entry;
+  c->local_space = local_space;
+
+  memcpy(c->values, items, 2 * sizeof(Value));
+  return MAKE_PTR(c);
+}
+
+Value MAKE_INT64(Stack* gc, int64_t x) {
+  if (x >= INT32_MIN && x <= INT32_MAX) return MAKE_INTEGER(x);
+
+  HeapValue* v = allocate(gc, TYPE_INT64, 0);
+  v->as_int64 = x;
+  return MAKE_PTR(v);
+}
+
 Value MAKE_MUTABLE(Stack* gc, Value x) {
   HeapValue* v = allocate(gc, TYPE_MUTABLE, 1);
   v->as_ptr = &x;
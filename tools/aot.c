@@ -0,0 +1,284 @@
+// Ahead-of-time compiler from Plume bytecode to C.
+//
+//   plume-aot program.bin program.c
+//   clang -O2 -Iinclude program.c -Llib -lplume-library -lgc -ldl -o program
+//
+// Each function of the bytecode becomes a C function built from the
+// instruction macros of include/aot.h. The bytecode itself is embedded in the
+// program, which still loads its constants and native libraries from it.
+
+#include <aot.h>
+#include <bytecode.h>
+#include <core/error.h>
+#include <deserializer.h>
+#include <passes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// C operators of integer comparisons, indexed by Comparison.
+static const char* int_operators[] = { "<", ">", "==", "!=", "<=", ">=", "&", "|" };
+
+// Same for IJumpElseRelCmp, indexed by ComparisonKind.
+static const char* icmp_operators[] = { [KindEqualTo] = "==", [KindAnd] = "&", [KindOr] = "|" };
+
+// Index of the function created by each header, in the order of headers, as
+// numbered by aot_main.
+static int32_t* function_indices;
+
+// Immediate values are inlined, heap values are read from the constant pool.
+static void emit_constant(FILE* out, Deserialized* module, int32_t idx) {
+  Value value = module->constants.constants[idx];
+
+  switch (get_type(value)) {
+    case TYPE_INTEGER: case TYPE_FLOAT: case TYPE_SPECIAL:
+      fprintf(out, "0x%016llxULL", (unsigned long long) value);
+      break;
+    default:
+      fprintf(out, "AOT_CONSTANT(%d)", idx);
+  }
+}
+
+static void emit_instruction(FILE* out, Deserialized* module, Instruction* instrs, int32_t i) {
+  Instruction instr = instrs[i];
+  int32_t i1 = instr.operand1, i2 = instr.operand2, i3 = instr.operand3;
+  int32_t target = jump_target(instrs, i);
+
+  // Tables are emitted with their switch.
+  if (instr.opcode == OP_SwitchCase) return;
+
+  fprintf(out, "  ");
+
+  switch (instr.opcode) {
+    case OP_LoadLocal: fprintf(out, "AOT_LOAD_LOCAL(%d);", i1); break;
+    case OP_StoreLocal: fprintf(out, "AOT_STORE_LOCAL(%d);", i1); break;
+    case OP_LoadGlobal: fprintf(out, "AOT_LOAD_GLOBAL(%d);", i1); break;
+    case OP_StoreGlobal: fprintf(out, "AOT_STORE_GLOBAL(%d);", i1); break;
+
+    case OP_LoadConstant:
+      fprintf(out, "AOT_LOAD_CONSTANT(");
+      emit_constant(out, module, i1);
+      fprintf(out, ");");
+      break;
+
+    case OP_Return: fprintf(out, "AOT_RETURN(sp[-1]);"); break;
+    case OP_ReturnUnit: fprintf(out, "AOT_RETURN_UNIT();"); break;
+
+    case OP_ReturnConst:
+      fprintf(out, "AOT_RETURN(");
+      emit_constant(out, module, i1);
+      fprintf(out, ");");
+      break;
+
+    case OP_Compare: fprintf(out, "AOT_COMPARE(%d);", i1); break;
+    case OP_And: fprintf(out, "AOT_LOGICAL(&&);"); break;
+    case OP_Or: fprintf(out, "AOT_LOGICAL(||);"); break;
+    case OP_LoadNative: fprintf(out, "AOT_LOAD_NATIVE(%d, %d, %d);", i1, i2, i3); break;
+    case OP_MakeList: fprintf(out, "AOT_MAKE_LIST(%d);", i1); break;
+    case OP_ListGet: fprintf(out, "AOT_LIST_GET(%d);", i1); break;
+    case OP_ConstructorTag: fprintf(out, "AOT_CONSTRUCTOR_TAG(%d);", i1); break;
+    case OP_GetIndex: fprintf(out, "AOT_GET_INDEX();"); break;
+    case OP_Slice: fprintf(out, "AOT_SLICE(%d);", i1); break;
+    case OP_ListLength: fprintf(out, "AOT_LIST_LENGTH();"); break;
+    case OP_TypeOf: fprintf(out, "AOT_TYPE_OF();"); break;
+    case OP_Special: fprintf(out, "AOT_SPECIAL();"); break;
+    case OP_Update: fprintf(out, "AOT_UPDATE();"); break;
+    case OP_MakeMutable: fprintf(out, "AOT_MAKE_MUTABLE();"); break;
+    case OP_UnMut: fprintf(out, "AOT_UNMUT();"); break;
+    case OP_Halt: fprintf(out, "return -1;"); break;
+
+    case OP_Add: fprintf(out, "AOT_ARITH(OP_Add);"); break;
+    case OP_Sub: fprintf(out, "AOT_ARITH(OP_Sub);"); break;
+    case OP_Mul: fprintf(out, "AOT_ARITH(OP_Mul);"); break;
+
+    case OP_AddConst: case OP_SubConst: case OP_MulConst:
+      fprintf(out, "AOT_ARITH_CONST(%s, ",
+              instr.opcode == OP_AddConst ? "OP_Add" : instr.opcode == OP_SubConst ? "OP_Sub" : "OP_Mul");
+      emit_constant(out, module, i1);
+      fprintf(out, ");");
+      break;
+
+    case OP_JumpRel: fprintf(out, "goto L%d;", target); break;
+    case OP_JumpElseRel: fprintf(out, "AOT_JUMP_ELSE(L%d);", target); break;
+    case OP_JumpElseRelCmp: fprintf(out, "AOT_JUMP_ELSE_CMP(%d, L%d);", i2, target); break;
+
+    case OP_IJumpElseRelCmp:
+      fprintf(out, "AOT_IJUMP_ELSE_CMP(%s, L%d);", icmp_operators[i1], target);
+      break;
+
+    case OP_JumpElseRelCmpConst:
+      fprintf(out, "AOT_JUMP_ELSE_CMP_CONST(");
+      emit_constant(out, module, i3);
+      fprintf(out, ", L%d);", target);
+      break;
+
+    case OP_IJumpElseRelCmpConst:
+      fprintf(out, "AOT_IJUMP_ELSE_CMP_CONST(%s, ", int_operators[i2]);
+      emit_constant(out, module, i3);
+      fprintf(out, ", L%d);", target);
+      break;
+
+    case OP_Switch: case OP_SwitchSparse:
+      fprintf(out, "AOT_SWITCH_BOXED(L%d); switch (aot_switch_key(*--sp)) {", target);
+      for (int32_t k = 1; k <= i2; k++) {
+        int32_t case_target = jump_target(instrs, i + k);
+        if (case_target == target) continue;
+
+        fprintf(out, " case %uu: goto L%d;", (uint32_t) instrs[i + k].operand2, case_target);
+      }
+      fprintf(out, " default: goto L%d; }", target);
+      break;
+
+    case OP_Call: fprintf(out, "AOT_CALL(*--sp, %d);", i1); break;
+    case OP_CallGlobal: fprintf(out, "AOT_CALL(values[%d], %d);", i1, i2); break;
+    case OP_CallLocal: fprintf(out, "AOT_CALL(bp[%d], %d);", i1, i2); break;
+    case OP_TailCall: fprintf(out, "AOT_TAIL_CALL(*--sp, %d);", i1); break;
+    case OP_TailCallGlobal: fprintf(out, "AOT_TAIL_CALL(values[%d], %d);", i1, i2); break;
+    case OP_TailCallLocal: fprintf(out, "AOT_TAIL_CALL(bp[%d], %d);", i1, i2); break;
+
+    // Bodies are compiled as separate functions, entered at the next
+    // instruction.
+    case OP_MakeLambda:
+      fprintf(out, "*sp++ = MAKE_FUNCTION(%d); goto L%d;", function_indices[i], target);
+      break;
+
+    case OP_MakeAndStoreLambda:
+      fprintf(out, "values[%d] = MAKE_FUNCTION(%d); goto L%d;", i1, function_indices[i], target);
+      break;
+
+    default:
+      THROW_FMT("Unsupported opcode %d at instruction %d", instr.opcode, i);
+  }
+
+  fprintf(out, "\n");
+}
+
+// Compiles the instructions reachable from `entry`, without entering the
+// bodies of the lambdas it creates.
+static void emit_function(FILE* out, Deserialized* module, Bytecode* bytecode, int32_t entry,
+                          bool* reached, bool* labeled, int32_t* worklist) {
+  Instruction* instrs = bytecode->instructions;
+  int32_t count = bytecode->instruction_count;
+  int32_t pending = 0;
+
+  for (int32_t i = 0; i < count; i++) reached[i] = labeled[i] = false;
+
+  reached[entry] = true;
+  worklist[pending++] = entry;
+
+  while (pending > 0) {
+    int32_t i = worklist[--pending];
+    int32_t successors[] = { falls_through(&instrs[i]) ? i + 1 : -1, jump_target(instrs, i) };
+
+    for (int32_t k = 0; k < 2; k++) {
+      int32_t next = successors[k];
+      if (next < 0 || next >= count || reached[next]) continue;
+
+      reached[next] = true;
+      worklist[pending++] = next;
+    }
+  }
+
+  // Instructions falling through are reached from the previous one, so only
+  // jump targets need labels.
+  for (int32_t i = 0; i < count; i++) {
+    int32_t target = jump_target(instrs, i);
+    if (reached[i] && target >= 0) labeled[target] = true;
+  }
+
+  fprintf(out, "static int32_t function_%d(Deserialized* module) {\n", entry);
+  fprintf(out, "  AOT_ENTER();\n\n");
+
+  for (int32_t i = 0; i < count; i++) {
+    if (!reached[i]) continue;
+
+    if (labeled[i]) fprintf(out, "L%d:\n", i);
+    emit_instruction(out, module, instrs, i);
+  }
+
+  fprintf(out, "}\n\n");
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) THROW_FMT("Usage: %s <input.bin> <output.c>", argv[0]);
+
+  FILE* file = fopen(argv[1], "rb");
+  if (file == NULL) THROW_FMT("Could not open file: %s", argv[1]);
+
+  fseek(file, 0, SEEK_END);
+  size_t size = ftell(file);
+  rewind(file);
+
+  uint8_t* bytes = malloc(size);
+  if (fread(bytes, 1, size, file) != size) THROW_FMT("Could not read file: %s", argv[1]);
+  rewind(file);
+
+  GC_init();
+
+  Deserialized module = deserialize(file, stack_new());
+  fclose(file);
+
+  // The same passes as in the interpreter, up to the ones depending on
+  // runtime state.
+  Bytecode bytecode = decode_bytecode(module.instrs, module.instr_count);
+  verify_bytecode(&module, &bytecode);
+  optimize_bytecode(&module, &bytecode);
+  detect_tail_calls(&bytecode);
+
+  Instruction* instrs = bytecode.instructions;
+  int32_t count = bytecode.instruction_count;
+
+  bool* entries = calloc(count + 1, sizeof(bool));
+  entries[0] = true;
+
+  function_indices = malloc((count + 1) * sizeof(int32_t));
+  int32_t function_count = 0;
+
+  for (int32_t i = 0; i < count; i++) {
+    if (instrs[i].opcode == OP_MakeLambda || instrs[i].opcode == OP_MakeAndStoreLambda) {
+      entries[i + 1] = true;
+      function_indices[i] = function_count++;
+    }
+  }
+
+  FILE* out = fopen(argv[2], "w");
+  if (out == NULL) THROW_FMT("Could not open file: %s", argv[2]);
+
+  fprintf(out, "// Generated by plume-aot from %s.\n\n", argv[1]);
+  fprintf(out, "#include <aot.h>\n\n");
+
+  bool* reached = malloc((count + 1) * sizeof(bool));
+  bool* labeled = malloc((count + 1) * sizeof(bool));
+  int32_t* worklist = malloc((count + 1) * sizeof(int32_t));
+
+  for (int32_t i = 0; i < count; i++) {
+    if (entries[i]) emit_function(out, &module, &bytecode, i, reached, labeled, worklist);
+  }
+
+  fprintf(out, "static AotFunction functions[%d] = {\n", count + 1);
+  for (int32_t i = 0; i < count; i++) {
+    if (entries[i]) fprintf(out, "  [%d] = function_%d,\n", i, i);
+  }
+  fprintf(out, "};\n\n");
+
+  fprintf(out, "static const uint8_t bytecode[%zu] = {", size);
+  for (size_t i = 0; i < size; i++) {
+    fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n  " : " ", bytes[i]);
+  }
+  fprintf(out, "\n};\n\n");
+
+  fprintf(out, "int main(int argc, char** argv) {\n");
+  fprintf(out, "  return aot_main(argc, argv, bytecode, sizeof(bytecode), functions);\n");
+  fprintf(out, "}\n");
+
+  fclose(out);
+
+  free(reached);
+  free(labeled);
+  free(worklist);
+  free(entries);
+  free(function_indices);
+  free(bytes);
+  free(bytecode.instructions);
+
+  return 0;
+}
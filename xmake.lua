@@ -37,4 +37,14 @@ target("plume-library")
   set_targetdir("lib")
   set_optimize("fastest")
   set_symbols("none")
-  add_cxflags("-fPIC")
\ No newline at end of file
+  add_cxflags("-fPIC")
+
+target("plume-aot")
+  add_rules("mode.release")
+  add_deps("plume-library")
+  add_packages("bdwgc")
+  add_files("tools/aot.c")
+  add_includedirs("include")
+  set_kind("binary")
+  set_targetdir("bin")
+  set_optimize("fastest")